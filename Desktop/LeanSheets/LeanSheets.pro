@@ -1,12 +1,26 @@
-QT += widgets
+QT += widgets concurrent
 #unix:qtHaveModule(dbus): QT += dbus widgets
 
 HEADERS += leansheets.h leandelegate.h leanitem.h \
+           leanaggregate.h leanformula.h leanpool.h \
+           leansort.h leantable.h leanindex.h \
+           leanpivot.h leanmapped.h leanarray.h \
+           leanworkbook.h leanfollow.h \
 
 SOURCES += main.cpp \
            leansheets.cpp \
            leandelegate.cpp \
            leanitem.cpp \
+           leanaggregate.cpp \
+           leanformula.cpp \
+           leansort.cpp \
+           leantable.cpp \
+           leanindex.cpp \
+           leanpivot.cpp \
+           leanmapped.cpp \
+           leanarray.cpp \
+           leanworkbook.cpp \
+           leanfollow.cpp \
 
 RESOURCES += \
     leanfiles.qrc
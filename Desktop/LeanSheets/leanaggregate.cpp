@@ -0,0 +1,20 @@
+#include "leanaggregate.h"
+
+#include <QHash>
+
+// Maps the name of an aggregate function onto its instantiation.
+LeanAggregate aggregateFor(const QString &name)
+{
+    static const QHash<QString, LeanAggregate> aggregates = {
+        { "sum=", &aggregateRange<SumOp> },
+        { "sumsq=", &aggregateRange<SumsqOp> },
+        { "product=", &aggregateRange<ProductOp> },
+        { "count=", &aggregateRange<CountOp> },
+        { "average=", &aggregateRange<AverageOp> },
+        { "min=", &aggregateRange<MinOp> },
+        { "max=", &aggregateRange<MaxOp> },
+        { "var=", &aggregateRange<VarOp> },
+        { "stdev=", &aggregateRange<StdevOp> },
+    };
+    return aggregates.value(name, nullptr);
+}
@@ -0,0 +1,283 @@
+#ifndef LEANAGGREGATE_H
+#define LEANAGGREGATE_H
+
+#include "leanitem.h"
+#include "leanpool.h"
+
+#include <QtConcurrent>
+#include <QtMath>
+
+#include <limits>
+
+// Ranges with more cells than this are reduced on the global thread pool.
+#define PARALLEL_CELLS 100000
+// Rows, or values, handed to each task; fixed so results never depend on
+// thread count.
+#define BLOCK_ROWS 16384
+
+/****************************************************************************
+** Each aggregate function of LeanSheets is a small policy type with an
+** init(), accumulate(), merge() and finalize() step over its own State.
+** aggregateRange() is instantiated once per policy, so the loop over a
+** range never has to ask which function it is computing, and states of
+** separate pieces of a range can be merged into one result. The numbers
+** of large ranges are read on the calling thread into one buffer, which is
+** cut into blocks folded on the thread pool and then merged in order.
+****************************************************************************/
+
+// Compensated (Kahan-Babuska) running sum, so that long sums and sums merged
+// from several blocks lose no more precision than a single addition.
+struct LeanSum
+{
+    double sum;
+    double compensation;
+
+    void add(double value)
+    {
+        double total = sum + value;
+        if (qAbs(sum) >= qAbs(value))
+            compensation += (sum - total) + value;
+        else
+            compensation += (value - total) + sum;
+        sum = total;
+    }
+    void add(const LeanSum &other)
+    {
+        add(other.sum);
+        compensation += other.compensation;
+    }
+    double value() const { return sum + compensation; }
+};
+
+struct SumOp
+{
+    struct State { LeanSum sum; };
+
+    static State init() { return State{{0, 0}}; }
+    static void accumulate(State &s, double value) { s.sum.add(value); }
+    static void merge(State &s, const State &other) { s.sum.add(other.sum); }
+    static QVariant finalize(const State &s) { return s.sum.value(); }
+};
+
+struct SumsqOp
+{
+    struct State { LeanSum sum; };
+
+    static State init() { return State{{0, 0}}; }
+    static void accumulate(State &s, double value) { s.sum.add(value * value); }
+    static void merge(State &s, const State &other) { s.sum.add(other.sum); }
+    static QVariant finalize(const State &s) { return s.sum.value(); }
+};
+
+struct ProductOp
+{
+    struct State { double product; };
+
+    static State init() { return State{1}; }
+    static void accumulate(State &s, double value) { s.product *= value; }
+    static void merge(State &s, const State &other) { s.product *= other.product; }
+    static QVariant finalize(const State &s) { return s.product; }
+};
+
+struct CountOp
+{
+    struct State { qint64 count; };
+
+    static State init() { return State{0}; }
+    static void accumulate(State &s, double) { s.count++; }
+    static void merge(State &s, const State &other) { s.count += other.count; }
+    static QVariant finalize(const State &s) { return double(s.count); }
+};
+
+struct AverageOp
+{
+    struct State { LeanSum sum; qint64 count; };
+
+    static State init() { return State{{0, 0}, 0}; }
+    static void accumulate(State &s, double value) { s.sum.add(value); s.count++; }
+    static void merge(State &s, const State &other) { s.sum.add(other.sum); s.count += other.count; }
+    static QVariant finalize(const State &s)
+    {
+        if (!s.count)
+            return QVariant();
+        return s.sum.value() / s.count;
+    }
+};
+
+struct MinOp
+{
+    struct State { double min; qint64 count; };
+
+    static State init() { return State{std::numeric_limits<double>::infinity(), 0}; }
+    static void accumulate(State &s, double value) { s.min = qMin(s.min, value); s.count++; }
+    static void merge(State &s, const State &other)
+    {
+        s.min = qMin(s.min, other.min);
+        s.count += other.count;
+    }
+    static QVariant finalize(const State &s)
+    {
+        if (!s.count)
+            return QVariant();
+        return s.min;
+    }
+};
+
+struct MaxOp
+{
+    struct State { double max; qint64 count; };
+
+    static State init() { return State{-std::numeric_limits<double>::infinity(), 0}; }
+    static void accumulate(State &s, double value) { s.max = qMax(s.max, value); s.count++; }
+    static void merge(State &s, const State &other)
+    {
+        s.max = qMax(s.max, other.max);
+        s.count += other.count;
+    }
+    static QVariant finalize(const State &s)
+    {
+        if (!s.count)
+            return QVariant();
+        return s.max;
+    }
+};
+
+// Sample variance, kept as a running mean and sum of squared deviations
+// (Welford) so that two partial states can be combined exactly (Chan).
+struct VarOp
+{
+    struct State { qint64 count; double mean; double m2; };
+
+    static State init() { return State{0, 0, 0}; }
+    static void accumulate(State &s, double value)
+    {
+        s.count++;
+        double delta = value - s.mean;
+        s.mean += delta / s.count;
+        s.m2 += delta * (value - s.mean);
+    }
+    static void merge(State &s, const State &other)
+    {
+        if (!other.count)
+            return;
+        if (!s.count)
+        {
+            s = other;
+            return;
+        }
+        qint64 count = s.count + other.count;
+        double delta = other.mean - s.mean;
+        s.mean += delta * other.count / count;
+        s.m2 += other.m2 + delta * delta * s.count * other.count / count;
+        s.count = count;
+    }
+    static QVariant finalize(const State &s)
+    {
+        if (s.count < 2)
+            return QVariant();
+        return s.m2 / (s.count - 1);
+    }
+};
+
+struct StdevOp : VarOp
+{
+    static QVariant finalize(const State &s)
+    {
+        QVariant variance = VarOp::finalize(s);
+        if (!variance.isValid())
+            return variance;
+        return qSqrt(variance.toDouble());
+    }
+};
+
+// Folds every numeric cell of a range, other than self, into one state.
+template <class Op>
+typename Op::State accumulateSerial(const QTableWidget *widget,
+                                    const QTableWidgetItem *self,
+                                    const LeanRange &range)
+{
+    typename Op::State state = Op::init();
+    for (int row = range.firstRow; row <= range.lastRow; ++row)
+    {
+        for (int col = range.firstCol; col <= range.lastCol; ++col)
+        {
+            const QTableWidgetItem *tableItem = widget->item(row, col);
+            double value = 0;
+            if (tableItem && tableItem != self && LeanItem::numberOf(tableItem, &value))
+                Op::accumulate(state, value);
+        }
+    }
+    return state;
+}
+
+// One block of the values of a parallel reduction and what it folded.
+template <class Op>
+struct LeanPartial
+{
+    int first;
+    int last;
+    typename Op::State state;
+};
+
+// The numbers of the range are read on the calling thread, since cells
+// belong to the widget and formulas may read any other cell while they
+// resolve. Only the plain buffer of numbers is handed to the thread pool,
+// which folds it one task per block.
+template <class Op>
+typename Op::State accumulateParallel(const QTableWidget *widget,
+                                      const QTableWidgetItem *self,
+                                      const LeanRange &range)
+{
+    LeanScratch scratch;
+    QVector<double> &values = scratch.numbers();
+    for (int row = range.firstRow; row <= range.lastRow; ++row)
+    {
+        for (int col = range.firstCol; col <= range.lastCol; ++col)
+        {
+            const QTableWidgetItem *tableItem = widget->item(row, col);
+            double value = 0;
+            if (tableItem && tableItem != self && LeanItem::numberOf(tableItem, &value))
+                values.append(value);
+        }
+    }
+
+    QVector<LeanPartial<Op> > partials;
+    for (int first = 0; first < values.size(); first += BLOCK_ROWS)
+        partials.append(LeanPartial<Op>{ first, qMin(first + BLOCK_ROWS, values.size()) - 1, Op::init() });
+
+    const double *numbers = values.constData();
+    QtConcurrent::blockingMap(partials, [numbers](LeanPartial<Op> &partial)
+    {
+        for (int index = partial.first; index <= partial.last; ++index)
+            Op::accumulate(partial.state, numbers[index]);
+    });
+
+    // Merging in block order keeps the result identical for any thread count.
+    typename Op::State state = Op::init();
+    for (const LeanPartial<Op> &partial : partials)
+        Op::merge(state, partial.state);
+    return state;
+}
+
+template <class Op>
+typename Op::State accumulateRange(const QTableWidget *widget,
+                                   const QTableWidgetItem *self,
+                                   const LeanRange &range)
+{
+    qint64 cells = qint64(range.lastRow - range.firstRow + 1) * (range.lastCol - range.firstCol + 1);
+    if (range.lastRow >= range.firstRow && cells > PARALLEL_CELLS)
+        return accumulateParallel<Op>(widget, self, range);
+    return accumulateSerial<Op>(widget, self, range);
+}
+
+template <class Op>
+QVariant aggregateRange(const QTableWidget *widget,
+                        const QTableWidgetItem *self,
+                        const LeanRange &range)
+{
+    return Op::finalize(accumulateRange<Op>(widget, self, range));
+}
+
+LeanAggregate aggregateFor(const QString &name);
+
+#endif // LEANAGGREGATE_H
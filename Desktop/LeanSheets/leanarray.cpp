@@ -0,0 +1,134 @@
+#include "leanarray.h"
+#include "leanitem.h"
+#include "leanworkbook.h"
+
+#include <QtMath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/****************************************************************************
+** Array formulas apply an operator element by element to whole ranges,
+** such as A1:A1000 * B1:B1000. Each side is first gathered into one
+** contiguous column of doubles, with a single cell or number repeated to
+** the same length, so that the operator itself is one tight pass over
+** memory, two doubles at a time where SSE2 is available.
+****************************************************************************/
+
+namespace {
+
+// The element-wise operators, each on one double and, where SSE2 is
+// available, on two at a time.
+struct AddKernel
+{
+    static double apply(double a, double b) { return a + b; }
+#if defined(__SSE2__)
+    static __m128d apply(__m128d a, __m128d b) { return _mm_add_pd(a, b); }
+#endif
+};
+
+struct SubtractKernel
+{
+    static double apply(double a, double b) { return a - b; }
+#if defined(__SSE2__)
+    static __m128d apply(__m128d a, __m128d b) { return _mm_sub_pd(a, b); }
+#endif
+};
+
+struct MultiplyKernel
+{
+    static double apply(double a, double b) { return a * b; }
+#if defined(__SSE2__)
+    static __m128d apply(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+#endif
+};
+
+struct DivideKernel
+{
+    static double apply(double a, double b) { return a / b; }
+#if defined(__SSE2__)
+    static __m128d apply(__m128d a, __m128d b) { return _mm_div_pd(a, b); }
+#endif
+};
+
+// One pass of a single operator, so that nothing is decided inside the loop.
+template <typename Kernel>
+void applyKernel(const double *left, const double *right, double *result, int count)
+{
+    int index = 0;
+#if defined(__SSE2__)
+    for (; index + 2 <= count; index += 2)
+        _mm_storeu_pd(result + index, Kernel::apply(_mm_loadu_pd(left + index), _mm_loadu_pd(right + index)));
+#endif
+    for (; index < count; index++)
+        result[index] = Kernel::apply(left[index], right[index]);
+}
+
+}
+
+// Applies op to every pair of elements of left and right. The operator is
+// picked once, and each has a loop of its own.
+void arrayKernel(char op, const double *left, const double *right, double *result, int count)
+{
+    if (op == '+')
+        applyKernel<AddKernel>(left, right, result, count);
+    else if (op == '-')
+        applyKernel<SubtractKernel>(left, right, result, count);
+    else if (op == '*')
+        applyKernel<MultiplyKernel>(left, right, result, count);
+    else if (op == '/')
+        applyKernel<DivideKernel>(left, right, result, count);
+    else
+    {
+        for (int index = 0; index < count; index++)
+            result[index] = qPow(left[index], right[index]);
+    }
+}
+
+// One side of an array formula, stretched to length. Cells of a range are
+// read row by row; past its end, or on a sheet that does not exist, there
+// is nothing to compute with.
+static QVector<double> arrayOperand(const LeanRange &range, const QString &sheet, const QString &token,
+                                    int length, const QTableWidget *widget, const QTableWidgetItem *self)
+{
+    if (range.firstRow < 0 || range.firstCol < 0)
+    {
+        bool isUnknownSheet = false;
+        const QTableWidgetItem *cur = LeanItem::referencedItem(token, widget, &isUnknownSheet);
+        if (isUnknownSheet)
+            return QVector<double>(length, qQNaN());
+        return QVector<double>(length, cur ? LeanItem::cellNumber(cur) : token.toDouble());
+    }
+
+    QVector<double> values(length, qQNaN());
+    widget = LeanWorkbook::sheetOf(sheet, widget);
+    if (!widget)
+        return values;
+    double *value = values.data();
+    int index = 0;
+    for (int row = range.firstRow; row <= range.lastRow && index < length; ++row)
+    {
+        for (int col = range.firstCol; col <= range.lastCol && index < length; ++col, ++index)
+        {
+            const QTableWidgetItem *cur = widget->item(row, col);
+            value[index] = (cur && cur != self) ? LeanItem::cellNumber(cur) : 0;
+        }
+    }
+    return values;
+}
+
+// Every result of an array formula, in the order they spill.
+QVector<double> arrayResult(const LeanFormula &formula, const QTableWidget *widget,
+                            const QTableWidgetItem *self)
+{
+    int length = formula.arrayLength();
+    QVector<double> left = arrayOperand(formula.leftRange, formula.leftSheet, formula.tokens.value(0),
+                                        length, widget, self);
+    QVector<double> right = arrayOperand(formula.rightRange, formula.rightSheet, formula.tokens.value(2),
+                                         length, widget, self);
+
+    QVector<double> result(length);
+    arrayKernel(formula.name.at(0).toLatin1(), left.constData(), right.constData(), result.data(), length);
+    return result;
+}
@@ -0,0 +1,15 @@
+#ifndef LEANARRAY_H
+#define LEANARRAY_H
+
+#include "leanformula.h"
+
+#include <QVector>
+
+class QTableWidget;
+class QTableWidgetItem;
+
+void arrayKernel(char op, const double *left, const double *right, double *result, int count);
+QVector<double> arrayResult(const LeanFormula &formula, const QTableWidget *widget,
+                            const QTableWidgetItem *self);
+
+#endif // LEANARRAY_H
@@ -1,15 +1,69 @@
 #include "leandelegate.h"
+#include "leanitem.h"
 
 /****************************************************************************
 ** The LeanDelegate class is derived from the QAbstractItemDelegate Class,
 ** which contains virtual functions designed to be reimplemented based on
 ** how data is stored in a model. In this case, QStrings are the main
-** intermediary for data manipulated in the LeanItem class.
+** intermediary for data manipulated in the LeanItem class. Cells of the
+** sheet the delegate belongs to are painted straight from the render a
+** LeanItem keeps, without going through the model role by role.
 ****************************************************************************/
 
 LeanDelegate::LeanDelegate(QObject *parent)
         : QItemDelegate(parent) {}
 
+// Paints a cell of the parent sheet as its background, text and focus, in
+// the colors of the window's state and with the cell's own background and
+// font when it has them.
+void LeanDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option,
+                         const QModelIndex &index) const
+{
+    const QTableWidget *table = qobject_cast<const QTableWidget *>(parent());
+    const QTableWidgetItem *cur = nullptr;
+    if (table && table->model() == index.model())
+        cur = table->item(index.row(), index.column());
+    if (!cur || cur->type() != LeanItem::LeanType)
+    {
+        QItemDelegate::paint(painter, option, index);
+        return;
+    }
+
+    const LeanRender &render = static_cast<const LeanItem *>(cur)->render();
+    QPalette::ColorGroup group = option.state & QStyle::State_Enabled ? QPalette::Normal : QPalette::Disabled;
+    if (group == QPalette::Normal && !(option.state & QStyle::State_Active))
+        group = QPalette::Inactive;
+
+    bool isSelected = option.state & QStyle::State_Selected;
+    QVariant background = cur->data(Qt::BackgroundRole);
+    if (isSelected)
+        painter->fillRect(option.rect, option.palette.brush(group, QPalette::Highlight));
+    else if (background.canConvert<QBrush>())
+        painter->fillRect(option.rect, qvariant_cast<QBrush>(background));
+
+    if (!render.text.isEmpty())
+    {
+        int margin = option.widget ? option.widget->style()->pixelMetric(QStyle::PM_FocusFrameHMargin, nullptr, option.widget) + 1 : 3;
+        QRect textRect = option.rect.adjusted(margin, 0, -margin, 0);
+        int alignment = render.isNumber ? Qt::AlignRight | Qt::AlignVCenter : Qt::AlignLeft | Qt::AlignVCenter;
+
+        QFont font = option.font;
+        QVariant cellFont = cur->data(Qt::FontRole);
+        if (cellFont.isValid())
+            font = qvariant_cast<QFont>(cellFont).resolve(option.font);
+        QFontMetrics metrics(font);
+
+        painter->save();
+        painter->setFont(font);
+        painter->setPen(isSelected ? option.palette.color(group, QPalette::HighlightedText) : render.color);
+        painter->drawText(textRect, alignment, metrics.elidedText(render.text, Qt::ElideRight, textRect.width()));
+        painter->restore();
+    }
+
+    if (option.state & QStyle::State_HasFocus)
+        drawFocus(painter, option, option.rect);
+}
+
 /** Copyright (C) 2016 The Qt Company Ltd. **/
 QWidget *LeanDelegate::createEditor(QWidget *parent,
                                           const QStyleOptionViewItem &,
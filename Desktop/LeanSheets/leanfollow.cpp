@@ -0,0 +1,76 @@
+#include "leanfollow.h"
+
+#include <QFile>
+
+LeanFollower::LeanFollower(const QString &fileName, QObject *parent)
+        : QObject(parent), path(fileName), offset(0)
+{
+    delay.setSingleShot(true);
+    delay.setInterval(FOLLOW_DELAY_MS);
+    connect(&delay, &QTimer::timeout, this, &LeanFollower::readAppended);
+    connect(&watcher, &QFileSystemWatcher::fileChanged, this, &LeanFollower::fileChanged);
+}
+
+// Reads what the file holds so far and starts watching it for more.
+bool LeanFollower::start()
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error = file.errorString();
+        return false;
+    }
+    file.close();
+
+    watcher.addPath(path);
+    readAppended();
+    return true;
+}
+
+// The first change starts the delay; later ones are read along with it.
+void LeanFollower::fileChanged()
+{
+    // A file replaced rather than written to is no longer being watched.
+    if (!watcher.files().contains(path) && QFile::exists(path))
+        watcher.addPath(path);
+
+    if (!delay.isActive())
+        delay.start();
+}
+
+void LeanFollower::readAppended()
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    if (file.size() < offset)
+    {
+        offset = 0;
+        partial.clear();
+        emit truncated();
+    }
+    if (!file.seek(offset))
+        return;
+
+    QByteArray appended = file.readAll();
+    offset += appended.size();
+    partial += appended;
+
+    int end = partial.lastIndexOf('\n');
+    if (end < 0)
+        return;
+
+    QList<QStringList> rows;
+    const QList<QByteArray> lines = partial.left(end).split('\n');
+    for (const QByteArray &line : lines)
+    {
+        QString text = QString::fromUtf8(line);
+        if (text.endsWith('\r'))
+            text.chop(1);
+        rows.append(text.split(','));
+    }
+    partial.remove(0, end + 1);
+
+    emit linesAppended(rows);
+}
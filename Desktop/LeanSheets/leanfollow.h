@@ -0,0 +1,51 @@
+#ifndef LEANFOLLOW_H
+#define LEANFOLLOW_H
+
+#include <QByteArray>
+#include <QFileSystemWatcher>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+
+// How long appends to a followed file are gathered before they are read.
+#define FOLLOW_DELAY_MS 250
+
+/****************************************************************************
+** A LeanFollower watches a comma separated file that keeps growing, such
+** as a log, and reads only what was appended since it last looked. Bytes
+** after the last complete line are kept until the rest of that line is
+** written. Changes are gathered for a short while and handed over as one
+** batch of rows, so a file written line by line is not re-read per line.
+** A file that shrank was rewritten, and is read again from the start.
+****************************************************************************/
+
+class LeanFollower : public QObject
+{
+    Q_OBJECT
+
+public:
+    LeanFollower(const QString &fileName, QObject *parent = 0);
+
+    bool start();
+    inline QString fileName() const { return path; }
+    inline QString errorString() const { return error; }
+
+signals:
+    void linesAppended(const QList<QStringList> &rows);
+    void truncated();
+
+private slots:
+    void fileChanged();
+    void readAppended();
+
+private:
+    QString path;
+    QString error;
+    QFileSystemWatcher watcher;
+    QTimer delay;
+    qint64 offset;
+    QByteArray partial;
+};
+
+#endif // LEANFOLLOW_H
@@ -0,0 +1,148 @@
+#include "leanformula.h"
+#include "leanaggregate.h"
+#include "leanpool.h"
+
+// Resolves everything about a formula that does not depend on cell values.
+LeanFormula LeanFormula::compile(const QStringList &tokens)
+{
+    LeanFormula formula;
+    formula.tokens = tokens;
+    formula.range = { -1, -1, -1, -1 };
+    formula.aggregate = nullptr;
+    formula.leftRange = formula.range;
+    formula.rightRange = formula.range;
+    formula.arrayValid = false;
+
+    if (LeanItem::isOperator(tokens.value(1)))
+    {
+        formula.name = tokens.value(1);
+        bool leftArray = decodeRange(tokens.value(0), &formula.leftRange, &formula.leftSheet);
+        bool rightArray = decodeRange(tokens.value(2), &formula.rightRange, &formula.rightSheet);
+        formula.isArray = leftArray || rightArray;
+        return formula;
+    }
+    formula.isArray = false;
+
+    formula.name = tokens.value(0).toLower();
+    formula.aggregate = aggregateFor(formula.name);
+
+    // The arguments of a function are bounded by their smallest and
+    // largest row and column, on the sheet named by the first of them.
+    // Lookups search the block between their second and third arguments.
+    int firstArg = LeanItem::isLookup(formula.name) ? 2 : 1;
+    int lastArg = LeanItem::isLookup(formula.name) ? 3 : tokens.count() - 1;
+    for (int pos = firstArg; pos <= lastArg; pos++)
+    {
+        int row = -1;
+        int col = -1;
+        QString sheet = decode_ref(tokens.value(pos), &row, &col);
+
+        if (pos == firstArg)
+        {
+            formula.range = { row, col, row, col };
+            formula.sheet = sheet;
+            continue;
+        }
+        formula.range.firstRow = qMin(formula.range.firstRow, row);
+        formula.range.firstCol = qMin(formula.range.firstCol, col);
+        formula.range.lastRow = qMax(formula.range.lastRow, row);
+        formula.range.lastCol = qMax(formula.range.lastCol, col);
+    }
+
+    return formula;
+}
+
+// Reads a token such as A1:B20 or Data!A1:B20 as the block between its
+// two cells.
+bool LeanFormula::decodeRange(const QString &token, LeanRange *range, QString *sheet)
+{
+    int colon = token.indexOf(':');
+    if (colon < 0)
+        return false;
+
+    int firstRow = -1;
+    int firstCol = -1;
+    int lastRow = -1;
+    int lastCol = -1;
+    *sheet = decode_ref(token.left(colon), &firstRow, &firstCol);
+    decode_ref(token.mid(colon + 1), &lastRow, &lastCol);
+    *range = { qMin(firstRow, lastRow), qMin(firstCol, lastCol),
+               qMax(firstRow, lastRow), qMax(firstCol, lastCol) };
+    return true;
+}
+
+// How many results an array formula spills: as many as its larger range.
+int LeanFormula::arrayLength() const
+{
+    int length = 1;
+    for (const LeanRange &operand : { leftRange, rightRange })
+    {
+        if (operand.firstRow < 0 || operand.firstCol < 0)
+            continue;
+        length = qMax(length, (operand.lastRow - operand.firstRow + 1) * (operand.lastCol - operand.firstCol + 1));
+    }
+    return length;
+}
+
+// Every block of cells this formula reads, for the dependency graph.
+QVector<LeanReference> LeanFormula::references() const
+{
+    QVector<LeanReference> blocks;
+    auto cell = [&blocks](const QString &token)
+    {
+        LeanReference reference;
+        int row = -1;
+        int col = -1;
+        reference.sheet = decode_ref(token, &row, &col);
+        reference.range = { row, col, row, col };
+        if (row >= 0 && col >= 0 && col < ALPHA)
+            blocks.append(reference);
+    };
+    auto block = [&blocks](const QString &sheet, const LeanRange &range)
+    {
+        if (range.firstRow >= 0 && range.firstCol >= 0)
+            blocks.append(LeanReference{ sheet, range });
+    };
+
+    if (LeanItem::isOperator(name))
+    {
+        if (leftRange.firstRow >= 0)
+            block(leftSheet, leftRange);
+        else
+            cell(tokens.value(0));
+        if (rightRange.firstRow >= 0)
+            block(rightSheet, rightRange);
+        else
+            cell(tokens.value(2));
+    }
+    else if (name == "sqrt=")
+        cell(tokens.value(1));
+    else if (LeanItem::isLookup(name))
+    {
+        cell(tokens.value(1));
+        LeanRange searched = range;
+        if (name == "vlookup=")
+            searched.lastCol = qMax(searched.lastCol, searched.firstCol + tokens.value(4).toInt() - 1);
+        block(sheet, searched);
+    }
+    else
+        block(sheet, range);
+    return blocks;
+}
+
+void *LeanFormula::operator new(size_t size)
+{
+    if (size != sizeof(LeanFormula))
+        return ::operator new(size);
+    return LeanPool<sizeof(LeanFormula)>::allocate();
+}
+
+void LeanFormula::operator delete(void *pointer, size_t size)
+{
+    if (!pointer)
+        return;
+    if (size != sizeof(LeanFormula))
+        ::operator delete(pointer);
+    else
+        LeanPool<sizeof(LeanFormula)>::release(pointer);
+}
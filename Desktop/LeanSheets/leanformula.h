@@ -0,0 +1,67 @@
+#ifndef LEANFORMULA_H
+#define LEANFORMULA_H
+
+#include <QStringList>
+#include <QVariant>
+#include <QVector>
+
+class QTableWidget;
+class QTableWidgetItem;
+
+// The block of cells a function runs over.
+struct LeanRange
+{
+    int firstRow;
+    int firstCol;
+    int lastRow;
+    int lastCol;
+};
+
+// A block of cells a formula reads, on the named sheet or its own.
+struct LeanReference
+{
+    QString sheet;
+    LeanRange range;
+};
+
+typedef QVariant (*LeanAggregate)(const QTableWidget *, const QTableWidgetItem *,
+                                  const LeanRange &);
+
+/****************************************************************************
+** A LeanFormula is the text of a formula cell compiled once per edit:
+** its tokens, the lower-cased function name or operator, the block its
+** cell arguments span, the sheet that block is on and, for aggregates,
+** the instantiation to run. An operator with a range such as A1:A100 on
+** either side is an array formula, whose results spill down from its cell
+** and are cached until the workbook marks the cell dirty. Formulas are
+** allocated from a LeanPool alongside the cells holding them.
+****************************************************************************/
+
+struct LeanFormula
+{
+    QStringList tokens;
+    QString name;
+    LeanRange range;
+    QString sheet;
+    LeanAggregate aggregate;
+
+    bool isArray;
+    LeanRange leftRange;
+    LeanRange rightRange;
+    QString leftSheet;
+    QString rightSheet;
+
+    mutable QVector<double> arrayValues;
+    mutable bool arrayValid;
+
+    int arrayLength() const;
+    QVector<LeanReference> references() const;
+
+    static LeanFormula compile(const QStringList &tokens);
+    static bool decodeRange(const QString &token, LeanRange *range, QString *sheet);
+
+    static void *operator new(size_t size);
+    static void operator delete(void *pointer, size_t size);
+};
+
+#endif // LEANFORMULA_H
@@ -0,0 +1,232 @@
+#include "leanindex.h"
+#include "leanitem.h"
+#include "leantable.h"
+#include "leanworkbook.h"
+
+#include <QScopedPointer>
+
+#include <algorithm>
+#include <climits>
+
+LeanIndex::LeanIndex(const QTableWidget *table, int column)
+        : table(table), column(column)
+{
+    // Built in one pass and sorted once, rather than cell by cell.
+    rowKeys.resize(table->rowCount());
+    for (int row = 0; row < table->rowCount(); row++)
+    {
+        const QTableWidgetItem *cur = table->item(row, column);
+        if (cur && cur->type() == LeanItem::LeanType
+                && static_cast<const LeanItem *>(cur)->isComputed())
+        {
+            formulaRows.append(row);
+            continue;
+        }
+
+        QString key = keyOf(cur);
+        if (key.isEmpty())
+            continue;
+
+        rowKeys[row] = key;
+        rowsByKey[key].append(row);
+        if (key.startsWith('n'))
+            sorted.append(qMakePair(key.mid(1).toDouble(), row));
+    }
+    std::sort(sorted.begin(), sorted.end());
+}
+
+// Re-reads one cell after it was edited.
+void LeanIndex::update(int row)
+{
+    if (row < 0 || row >= rowKeys.size())
+        return;
+    remove(row);
+    insert(row);
+}
+
+// Makes room for rows added at the bottom of the sheet, which start empty.
+void LeanIndex::grow(int rows)
+{
+    if (rows > rowKeys.size())
+        rowKeys.resize(rows);
+}
+
+void LeanIndex::insert(int row)
+{
+    const QTableWidgetItem *cur = table->item(row, column);
+    if (cur && cur->type() == LeanItem::LeanType
+            && static_cast<const LeanItem *>(cur)->isComputed())
+    {
+        formulaRows.insert(std::lower_bound(formulaRows.begin(), formulaRows.end(), row), row);
+        return;
+    }
+
+    QString key = keyOf(cur);
+    rowKeys[row] = key;
+    if (key.isEmpty())
+        return;
+
+    QVector<int> &rows = rowsByKey[key];
+    rows.insert(std::lower_bound(rows.begin(), rows.end(), row), row);
+
+    if (key.startsWith('n'))
+    {
+        QPair<double, int> entry(key.mid(1).toDouble(), row);
+        sorted.insert(std::lower_bound(sorted.begin(), sorted.end(), entry), entry);
+    }
+}
+
+void LeanIndex::remove(int row)
+{
+    QVector<int>::iterator formulaRow = std::lower_bound(formulaRows.begin(), formulaRows.end(), row);
+    if (formulaRow != formulaRows.end() && *formulaRow == row)
+        formulaRows.erase(formulaRow);
+
+    QString key = rowKeys.at(row);
+    if (key.isEmpty())
+        return;
+    rowKeys[row] = QString();
+
+    QVector<int> &rows = rowsByKey[key];
+    rows.erase(std::lower_bound(rows.begin(), rows.end(), row));
+    if (rows.isEmpty())
+        rowsByKey.remove(key);
+
+    if (key.startsWith('n'))
+    {
+        QPair<double, int> entry(key.mid(1).toDouble(), row);
+        sorted.erase(std::lower_bound(sorted.begin(), sorted.end(), entry));
+    }
+}
+
+// The first row between firstRow and lastRow holding key, or -1.
+int LeanIndex::exactMatch(const QString &key, int firstRow, int lastRow) const
+{
+    int best = -1;
+    QHash<QString, QVector<int> >::const_iterator found = rowsByKey.constFind(key);
+    if (found != rowsByKey.constEnd())
+    {
+        QVector<int>::const_iterator row = std::lower_bound(found->constBegin(), found->constEnd(), firstRow);
+        if (row != found->constEnd() && *row <= lastRow)
+            best = *row;
+    }
+
+    // Only formulas above the best plain match can still beat it.
+    int limit = best < 0 ? lastRow : best - 1;
+    QVector<int>::const_iterator row = std::lower_bound(formulaRows.constBegin(), formulaRows.constEnd(), firstRow);
+    for (; row != formulaRows.constEnd() && *row <= limit; ++row)
+    {
+        if (keyOf(LeanItem::cellValue(table->item(*row, column))) == key)
+            return *row;
+    }
+    return best;
+}
+
+// The first row between firstRow and lastRow holding the largest number
+// that is no larger than key, or -1.
+int LeanIndex::approximateMatch(double key, int firstRow, int lastRow) const
+{
+    int bestRow = -1;
+    double bestValue = 0;
+
+    int pos = std::upper_bound(sorted.constBegin(), sorted.constEnd(), qMakePair(key, INT_MAX))
+            - sorted.constBegin() - 1;
+    while (pos >= 0 && (sorted.at(pos).second < firstRow || sorted.at(pos).second > lastRow))
+        pos--;
+    if (pos >= 0)
+    {
+        bestValue = sorted.at(pos).first;
+        bestRow = std::lower_bound(sorted.constBegin(), sorted.constEnd(), qMakePair(bestValue, firstRow))->second;
+    }
+
+    QVector<int>::const_iterator row = std::lower_bound(formulaRows.constBegin(), formulaRows.constEnd(), firstRow);
+    for (; row != formulaRows.constEnd() && *row <= lastRow; ++row)
+    {
+        QVariant value = LeanItem::cellValue(table->item(*row, column));
+        if (value.type() != QVariant::Double || value.toDouble() > key)
+            continue;
+        if (bestRow < 0 || value.toDouble() > bestValue || (value.toDouble() == bestValue && *row < bestRow))
+        {
+            bestValue = value.toDouble();
+            bestRow = *row;
+        }
+    }
+    return bestRow;
+}
+
+// Numbers are keyed by value and text without regard to case, so that
+// "5", "5.0" and a formula giving 5 all match each other.
+QString LeanIndex::keyOf(const QVariant &value)
+{
+    bool isNumber = value.type() == QVariant::Double;
+    double number = isNumber ? value.toDouble() : value.toString().toDouble(&isNumber);
+    if (isNumber)
+        return "n" + QString::number(number, 'g', 17);
+
+    QString text = value.toString();
+    if (text.isEmpty())
+        return QString();
+    return "s" + text.toLower();
+}
+
+QString LeanIndex::keyOf(const QTableWidgetItem *item)
+{
+    if (!item)
+        return QString();
+    return keyOf(LeanItem::cellValue(item));
+}
+
+// Method for 'match=' and 'vlookup=' functions.
+QVariant lookupResult(const LeanFormula &formula, const QTableWidget *widget)
+{
+    const QStringList &list = formula.tokens;
+    const LeanRange &range = formula.range;
+
+    // The key may name a cell of any sheet; the block is on the sheet its
+    // range names, if not the formula's own.
+    const QTableWidgetItem *keyItem = LeanItem::referencedItem(list.value(1), widget);
+    widget = LeanWorkbook::sheetOf(formula.sheet, widget);
+    if (!widget)
+        return "#REF!";
+
+    int lastRow = qMin(range.lastRow, widget->rowCount() - 1);
+    if (range.firstRow < 0 || range.firstCol < 0 || range.firstCol >= widget->columnCount())
+        return "#N/A";
+
+    // The key is a cell when it names one, and a literal otherwise.
+    QVariant key = keyItem ? LeanItem::cellValue(keyItem) : QVariant(list.value(1));
+
+    bool isMatch = formula.name == "match=";
+    bool approximate = list.value(isMatch ? 4 : 5).toInt() != 0;
+
+    QScopedPointer<LeanIndex> local;
+    LeanIndex *index = nullptr;
+    if (const LeanTable *table = qobject_cast<const LeanTable *>(widget))
+        index = table->columnIndex(range.firstCol);
+    else
+    {
+        local.reset(new LeanIndex(widget, range.firstCol));
+        index = local.data();
+    }
+
+    int row = -1;
+    if (approximate)
+    {
+        bool isNumber = false;
+        double number = key.toDouble(&isNumber);
+        if (isNumber)
+            row = index->approximateMatch(number, range.firstRow, lastRow);
+    }
+    else
+        row = index->exactMatch(LeanIndex::keyOf(key), range.firstRow, lastRow);
+
+    if (row < 0)
+        return "#N/A";
+    if (isMatch)
+        return double(row - range.firstRow + 1);
+
+    int col = range.firstCol + list.value(4).toInt() - 1;
+    if (col < 0 || col >= widget->columnCount())
+        return "#REF!";
+    return LeanItem::cellValue(widget->item(row, col));
+}
@@ -0,0 +1,52 @@
+#ifndef LEANINDEX_H
+#define LEANINDEX_H
+
+#include "leanformula.h"
+
+#include <QHash>
+#include <QPair>
+#include <QVector>
+
+class QTableWidget;
+class QTableWidgetItem;
+
+/****************************************************************************
+** A LeanIndex answers lookups on one column of a sheet without scanning
+** it: a hash from cell value to the rows holding it for exact matches,
+** and the numeric values in sorted order for approximate matches. Indexes
+** are built on the first lookup and then kept up to date one cell at a
+** time, growing with rows appended to the sheet. Formula results may
+** change without their cell being edited, so formula rows are kept aside
+** and evaluated whenever a lookup needs them.
+****************************************************************************/
+
+class LeanIndex
+{
+public:
+    LeanIndex(const QTableWidget *table, int column);
+
+    void update(int row);
+    void grow(int rows);
+
+    int exactMatch(const QString &key, int firstRow, int lastRow) const;
+    int approximateMatch(double key, int firstRow, int lastRow) const;
+
+    static QString keyOf(const QVariant &value);
+    static QString keyOf(const QTableWidgetItem *item);
+
+private:
+    void insert(int row);
+    void remove(int row);
+
+    const QTableWidget *table;
+    int column;
+
+    QVector<QString> rowKeys;
+    QHash<QString, QVector<int> > rowsByKey;
+    QVector<QPair<double, int> > sorted;
+    QVector<int> formulaRows;
+};
+
+QVariant lookupResult(const LeanFormula &formula, const QTableWidget *widget);
+
+#endif // LEANINDEX_H
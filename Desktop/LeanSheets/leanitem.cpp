@@ -1,24 +1,64 @@
 #include "leanitem.h"
-
+#include "leanaggregate.h"
+#include "leanarray.h"
+#include "leanindex.h"
+#include "leanpool.h"
+#include "leantable.h"
+#include "leanworkbook.h"
+
+#include <QLocale>
+#include <QRegularExpression>
 #include <QtMath>
 
+#include <cfloat>
+
 /****************************************************************************
 ** The LeanItem class is responsible for managing data in each cell of the
-** QTableWidget, also known generically as a QTableWidgetItem. The
+** QTableWidget, also known generically as a QTableWidgetItem. Each edit
+** classifies the text of a cell once as empty, a number, a string, a
+** formula or an error, and each change renders it once, so that repaints
+** never have to parse or format it again.
+** Array formulas fill the cells below them with Spill cells, which hold
+** no text of their own and read their result from the formula. The
 ** functionResult() method in particular determines which functions or
 ** operators to call based on the QString returned by the function() method.
 ****************************************************************************/
 
 /** Copyright (C) 2016 The Qt Company Ltd. **/
 LeanItem::LeanItem()
-        : QTableWidgetItem(), isResolving(false)
+        : QTableWidgetItem(LeanType), typeTag(Empty), numberValue(0), formula(nullptr),
+          spill(0), spillBlocked(false), isResolving(false), isRendered(false)
 {
 }
 
 /** Copyright (C) 2016 The Qt Company Ltd. **/
 LeanItem::LeanItem(const QString &text)
-        : QTableWidgetItem(text), isResolving(false)
+        : QTableWidgetItem(text, LeanType), typeTag(Empty), numberValue(0), formula(nullptr),
+          spill(0), spillBlocked(false), isResolving(false), isRendered(false)
+{
+    classify(text);
+}
+
+LeanItem::~LeanItem()
 {
+    delete formula;
+}
+
+// Copies the text and tag of another cell, with its own compiled formula.
+LeanItem &LeanItem::operator=(const LeanItem &other)
+{
+    if (this == &other)
+        return *this;
+
+    QTableWidgetItem::operator=(other);
+    typeTag = other.typeTag;
+    numberValue = other.numberValue;
+    spill = other.spill;
+    spillBlocked = other.spillBlocked;
+    isRendered = false;
+    delete formula;
+    formula = other.formula ? new LeanFormula(*other.formula) : nullptr;
+    return *this;
 }
 
 /** Copyright (C) 2016 The Qt Company Ltd. **/
@@ -36,49 +76,384 @@ QVariant LeanItem::data(int role) const
         return function();
 
     if (role == Qt::DisplayRole)
-        return display();
-
-    QString t = display().toString();
-    bool isNumber = false;
-    int number = t.toDouble(&isNumber);
+        return render().text;
 
     if (role == Qt::TextColorRole)
+        return QVariant::fromValue(render().color);
+
+    if (role == Qt::TextAlignmentRole && render().isNumber)
+        return (int)(Qt::AlignRight | Qt::AlignVCenter);
+
+    return QTableWidgetItem::data(role);
+}
+
+// The text, color and alignment of this cell. Plain values are rendered
+// once per edit; formulas whenever their workbook marked them dirty. Spill
+// cells are cheap to render from the cached results of their formula.
+// Computed numbers are formatted as the stock delegate would, in the
+// current locale and to DBL_DIG significant digits.
+const LeanRender &LeanItem::render() const
+{
+    if (isRendered && (!isComputed() || (typeTag != Spill && isTracked())))
+        return rendered;
+
+    bool isNumber = typeTag == Number;
+    double number = numberValue;
+    if (isComputed())
     {
-        if (!isNumber)
-            return QVariant::fromValue(QColor(Qt::black));
-        else if (number < 0)
-            return QVariant::fromValue(QColor(Qt::red));
-        return QVariant::fromValue(QColor(Qt::blue));
+        QVariant result = display();
+        isNumber = result.type() == QVariant::Double;
+        number = result.toDouble();
+        rendered.text = isNumber ? QLocale().toString(number, 'g', DBL_DIG) : result.toString();
     }
+    else
+        rendered.text = function();
 
-     if (role == Qt::TextAlignmentRole)
-         if (!t.isEmpty() && (t.at(0).isNumber() || t.at(0) == '-'))
-             return (int)(Qt::AlignRight | Qt::AlignVCenter);
+    rendered.isNumber = isNumber;
+    if (!isNumber)
+        rendered.color = Qt::black;
+    else if (number < 0)
+        rendered.color = Qt::red;
+    else
+        rendered.color = Qt::blue;
+
+    isRendered = true;
+    return rendered;
+}
+
+// Forgets what was computed for this cell, because something it reads changed.
+void LeanItem::markDirty() const
+{
+    isRendered = false;
+    if (formula)
+        formula->arrayValid = false;
+}
 
-     return QTableWidgetItem::data(role);
+// Whether a workbook marks this cell dirty when what it reads changes, so
+// that what was computed for it can be kept until then.
+bool LeanItem::isTracked() const
+{
+    const LeanTable *table = qobject_cast<const LeanTable *>(tableWidget());
+    return table && table->workbook();
 }
 
 /** Copyright (C) 2016 The Qt Company Ltd. **/
 void LeanItem::setData(int role, const QVariant &value)
 {
+    // Tagged first, so that anyone told about the change sees the new type.
+    if (role == Qt::EditRole || role == Qt::DisplayRole)
+        classify(value.toString());
     QTableWidgetItem::setData(role, value);
-    if (tableWidget())
-        tableWidget()->viewport()->update();
 }
 
 /** Copyright (C) 2016 The Qt Company Ltd. **/
 QVariant LeanItem::display() const
 {
+    // plain values are shown exactly as they were typed
+    if (!isComputed())
+        return function();
+
+    // a spill cell shows its share of the array formula above it
+    if (typeTag == Spill)
+    {
+        const QTableWidget *widget = tableWidget();
+        if (!widget)
+            return QVariant();
+        const QTableWidgetItem *anchor = widget->item(widget->row(this) - spill, widget->column(this));
+        if (!anchor || anchor->type() != LeanType || !static_cast<const LeanItem *>(anchor)->isArray())
+            return QVariant();
+        return static_cast<const LeanItem *>(anchor)->arrayValue(spill);
+    }
+
     // avoid circular dependencies
     if (isResolving)
         return QVariant();
 
+    if (formula->isArray)
+        return arrayValue(0);
+
     isResolving = true;
-    QVariant result = functionResult(function(), tableWidget(), this);
+    QVariant result = evaluate(*formula, tableWidget(), this);
     isResolving = false;
     return result;
 }
 
+// The numeric value of this cell; strings, errors and empty cells count as 0.
+double LeanItem::number() const
+{
+    if (typeTag == Number)
+        return numberValue;
+    if (isComputed())
+        return display().toDouble();
+    return 0;
+}
+
+bool LeanItem::isArray() const
+{
+    return typeTag == Formula && formula->isArray;
+}
+
+// How many cells the results of this array formula take, itself included.
+int LeanItem::arrayLength() const
+{
+    return isArray() ? formula->arrayLength() : 0;
+}
+
+// One result of this array formula. All of them are computed together and
+// kept until the formula is marked dirty, so that each spill cell costs a
+// lookup rather than a pass over the ranges.
+QVariant LeanItem::arrayValue(int offset) const
+{
+    if (!isArray() || spillBlocked)
+        return offset ? QVariant() : QVariant("#SPILL!");
+
+    if (!formula->arrayValid || !isTracked())
+    {
+        if (isResolving)
+            return QVariant(); // avoid circular dependencies
+        isResolving = true;
+        formula->arrayValues = arrayResult(*formula, tableWidget(), this);
+        formula->arrayValid = true;
+        isResolving = false;
+    }
+
+    double value = formula->arrayValues.value(offset, qQNaN());
+    if (!qIsFinite(value))
+        return QVariant();
+    return value;
+}
+
+// Marks this array formula as having no room below it to spill into.
+void LeanItem::setSpillBlocked(bool blocked)
+{
+    spillBlocked = blocked;
+    isRendered = false;
+}
+
+// A cell showing the result offset rows below its array formula.
+LeanItem *LeanItem::spillOf(int offset)
+{
+    LeanItem *item = new LeanItem();
+    item->typeTag = Spill;
+    item->spill = offset;
+    return item;
+}
+
+// The numeric value of any cell, using the type tag when it is a LeanItem.
+double LeanItem::cellNumber(const QTableWidgetItem *item)
+{
+    if (!item)
+        return 0;
+    if (item->type() == LeanType)
+        return static_cast<const LeanItem *>(item)->number();
+    return item->text().toDouble();
+}
+
+// The value of any cell as a result: numbers as doubles, anything else as
+// it is displayed.
+QVariant LeanItem::cellValue(const QTableWidgetItem *item)
+{
+    if (!item)
+        return QVariant();
+    if (item->type() != LeanType)
+        return item->text();
+
+    const LeanItem *leanItem = static_cast<const LeanItem *>(item);
+    if (leanItem->cellType() == Number)
+        return leanItem->number();
+    return leanItem->display();
+}
+
+// Reads the number of a cell into value, if it holds one that aggregate
+// functions should count. A computed cell only counts when its result is
+// a number: not an error such as #N/A or #SPILL!, nor an empty result or
+// spill cell. The result is worked out once, for the test and the value.
+bool LeanItem::numberOf(const QTableWidgetItem *item, double *value)
+{
+    if (item->type() != LeanType)
+    {
+        bool isNumber = false;
+        *value = item->text().toDouble(&isNumber);
+        return isNumber;
+    }
+
+    const LeanItem *leanItem = static_cast<const LeanItem *>(item);
+    if (leanItem->cellType() == Number)
+    {
+        *value = leanItem->numberValue;
+        return true;
+    }
+    if (!leanItem->isComputed())
+        return false;
+
+    QVariant result = leanItem->display();
+    if (result.type() != QVariant::Double)
+        return false;
+    *value = result.toDouble();
+    return true;
+}
+
+bool LeanItem::isOperator(const QString &token)
+{
+    return token == "+" || token == "-" || token == "*" || token == "/" || token == "^";
+}
+
+bool LeanItem::isFunction(const QString &token)
+{
+    return token == "sqrt=" || token == "median=" || isLookup(token) || aggregateFor(token);
+}
+
+bool LeanItem::isLookup(const QString &token)
+{
+    return token == "match=" || token == "vlookup=";
+}
+
+// The cell a token such as B2 or Data!B2 names, if there is one.
+// isUnknownSheet tells whether the token names a sheet that does not exist.
+const QTableWidgetItem *LeanItem::referencedItem(const QString &token,
+                                                 const QTableWidget *widget,
+                                                 bool *isUnknownSheet)
+{
+    int row = 0;
+    int col = 0;
+    QString sheet = decode_ref(token, &row, &col);
+    const QTableWidget *source = LeanWorkbook::sheetOf(sheet, widget);
+    if (isUnknownSheet)
+        *isUnknownSheet = !source;
+    return source ? source->item(row, col) : nullptr;
+}
+
+// Tags the text of this cell, parsing numbers and formulas once per edit.
+void LeanItem::classify(const QString &text)
+{
+    delete formula;
+    formula = nullptr;
+    numberValue = 0;
+    spill = 0;
+    spillBlocked = false;
+    isRendered = false;
+
+    if (text.trimmed().isEmpty())
+    {
+        typeTag = Empty;
+        return;
+    }
+
+    bool isNumber = false;
+    double value = text.toDouble(&isNumber);
+    if (isNumber)
+    {
+        typeTag = Number;
+        numberValue = value;
+        return;
+    }
+
+    QStringList list = text.split(' ');
+    QString first = list.value(0).toLower();
+    if (isOperator(list.value(1)) || isFunction(first))
+    {
+        typeTag = Formula;
+        formula = new LeanFormula(LeanFormula::compile(list));
+    }
+    else if (first.endsWith('='))
+        typeTag = Error; // looks like a function, but not one we know
+    else
+        typeTag = String;
+}
+
+// The name of the sheet a token of a formula reads from, as compile()
+// decides it: the arguments of a function all read the sheet named by the
+// first of them, and any other token the sheet it names itself, if any.
+static QString tokenSheet(const QStringList &tokens, int pos)
+{
+    QString name = tokens.value(0).toLower();
+    int firstArg = LeanItem::isLookup(name) ? 2 : 1;
+    int lastArg = LeanItem::isLookup(name) ? 3 : tokens.count() - 1;
+    if (!LeanItem::isOperator(tokens.value(1)) && pos >= firstArg && pos <= lastArg)
+        pos = firstArg;
+
+    int row = -1;
+    int col = -1;
+    return decode_ref(tokens.at(pos).section(':', 0, 0), &row, &col);
+}
+
+// Rewrites references to cells at or past (atRow, atCol) of the sheet
+// named 'sheet' after rows and columns have been inserted in front of
+// them. References naming no sheet read ownSheet, the one of this cell.
+void LeanItem::shiftReferences(const QString &sheet, const QString &ownSheet,
+                               int atRow, int rows, int atCol, int cols)
+{
+    if (typeTag != Formula)
+        return;
+
+    static const QRegularExpression reference("^[A-Za-z][0-9]+$");
+    QStringList list = formula->tokens;
+    bool shifted = false;
+
+    for (int pos = 0; pos < list.count(); pos++)
+    {
+        QString read = tokenSheet(formula->tokens, pos);
+        if ((read.isEmpty() ? ownSheet : read).compare(sheet, Qt::CaseInsensitive) != 0)
+            continue;
+
+        // Both ends of a range such as A1:A20 move on their own.
+        QStringList parts = list.at(pos).split(':');
+        for (int part = 0; part < parts.count(); part++)
+        {
+            int bang = parts.at(part).lastIndexOf('!');
+            QString cell = parts.at(part).mid(bang + 1);
+            if (!reference.match(cell).hasMatch())
+                continue;
+
+            int row = 0;
+            int col = 0;
+            decode_pos(cell, &row, &col);
+            int newRow = (rows && row >= atRow) ? row + rows : row;
+            int newCol = (cols && col >= atCol) ? col + cols : col;
+            if (newRow == row && newCol == col)
+                continue;
+
+            // A cell pushed off the sheet no longer exists to be read.
+            if (newRow < 0 || newCol < 0 || newCol >= ALPHA)
+                parts[part] = "#REF!";
+            else
+                parts[part] = parts.at(part).left(bang + 1) + encode_pos(newRow, newCol);
+            shifted = true;
+        }
+        list[pos] = parts.join(':');
+    }
+
+    if (shifted)
+        setText(list.join(' '));
+}
+
+// Rewrites references naming the sheet oldName to name newName instead.
+void LeanItem::renameReferences(const QString &oldName, const QString &newName)
+{
+    if (typeTag != Formula)
+        return;
+
+    QStringList list = formula->tokens;
+    bool renamed = false;
+
+    for (int pos = 0; pos < list.count(); pos++)
+    {
+        QStringList parts = list.at(pos).split(':');
+        for (int part = 0; part < parts.count(); part++)
+        {
+            int bang = parts.at(part).lastIndexOf('!');
+            if (bang < 0 || parts.at(part).left(bang).compare(oldName, Qt::CaseInsensitive) != 0)
+                continue;
+            parts[part] = newName + parts.at(part).mid(bang);
+            renamed = true;
+        }
+        list[pos] = parts.join(':');
+    }
+
+    if (renamed)
+        setText(list.join(' '));
+}
+
 // Where LeanSheets' functions and operators roam.
 QVariant LeanItem::functionResult(const QString &function,
                                          const QTableWidget *widget,
@@ -89,198 +464,132 @@ QVariant LeanItem::functionResult(const QString &function,
     if (list.isEmpty() || !widget)
         return function; // it is a normal string
 
+    return evaluate(LeanFormula::compile(list), widget, self);
+}
+
+// Evaluates a formula that was compiled when its cell was edited.
+QVariant LeanItem::evaluate(const LeanFormula &formula,
+                            const QTableWidget *widget,
+                            const QTableWidgetItem *self)
+{
+    const QStringList &list = formula.tokens;
+    if (list.isEmpty() || !widget)
+        return list.join(' ');
+
     // What we'll return.
     QVariant result;
 
+    // An operator over ranges gives the first of its results here; the
+    // rest are spilled by the sheet.
+    if (formula.isArray)
+    {
+        double first = arrayResult(formula, widget, self).value(0, qQNaN());
+        if (qIsFinite(first))
+            result = first;
+        return result;
+    }
+
     // If an operator is called:
-    if (list.value(1) == "+" || list.value(1) == "-" || list.value(1) == "*" || list.value(1) == "/" || list.value(1) == "^")
+    if (isOperator(formula.name))
     {
-        int opRow = 0;
-        int opCol  = 0;
+        bool isLeftUnknown = false;
+        bool isRightUnknown = false;
 
         // Collects data based on the row and column of the cell entered.
-        decode_pos(list.value(0), &opRow, &opCol);
-        const QTableWidgetItem *left = widget->item(opRow, opCol);
-        decode_pos(list.value(2), &opRow, &opCol);
-        const QTableWidgetItem *right = widget->item(opRow, opCol);
+        const QTableWidgetItem *left = referencedItem(list.value(0), widget, &isLeftUnknown);
+        const QTableWidgetItem *right = referencedItem(list.value(2), widget, &isRightUnknown);
+        if (isLeftUnknown || isRightUnknown)
+            return "#REF!";
 
         double leftHand = 0;
         double rightHand = 0;
 
         QString temp = list.value(0);
-        leftHand = left ? left->text().toDouble() : temp.toDouble();
+        leftHand = left ? cellNumber(left) : temp.toDouble();
         temp = list.value(2);
-        rightHand = right ? right->text().toDouble() : temp.toDouble();
+        rightHand = right ? cellNumber(right) : temp.toDouble();
 
         // Methods for each operator:
-        if (list.value(1) == "+")
+        if (formula.name == "+")
             result = leftHand + rightHand;
-        else if (list.value(1) == "-")
+        else if (formula.name == "-")
             result = leftHand - rightHand;
-        else if (list.value(1) == "*")
+        else if (formula.name == "*")
             result = leftHand * rightHand;
-        else if (list.value(1) == "/" && rightHand != 0)
+        else if (formula.name == "/" && rightHand != 0)
             result = leftHand / rightHand;
-        else if (list.value(1) == "^")
+        else if (formula.name == "^")
             result = qPow(leftHand, rightHand);
 
         return result;
     }
 
-    QString splitFunction = list.value(0).toLower();
+    const LeanRange &range = formula.range;
 
-    int singleRow = -1;
-    int singleCol = -1;
-    int firstRow = -1;
-    int firstCol = -1;
-    int lastRow = -1;
-    int lastCol = -1;
+    // The sheet the arguments are on, when they name another one.
+    const QTableWidget *source = LeanWorkbook::sheetOf(formula.sheet, widget);
+    if (!source)
+        return "#REF!";
 
-    // Stores consecutive rows and columns into QVectors below.
-    QVector<int> numRows;
-    QVector<int> numCols;
-
-    for (int pos = 1; pos < list.count(); pos++)
-    {
-        decode_pos(list.value(pos), &singleRow, &singleCol);
-        numRows.append(singleRow);
-        numCols.append(singleCol);
-    }
-
-    if (!numRows.empty() && !numCols.empty())
-    {
-        qSort(numRows.begin(), numRows.end());
-        qSort(numCols.begin(), numCols.end());
-        firstRow = numRows.first();
-        firstCol = numCols.first();
-        lastRow = numRows.last();
-        lastCol = numCols.last();
-    }
-
-    // Methods for 'sum=' and 'product='
-    if (splitFunction == "sum=" || splitFunction == "product=")
-    {
-        double sum = 0;
-        double prod = 1;
-
-        for (int row = firstRow; row <= lastRow; ++row)
-        {
-            for (int col = firstCol; col <= lastCol; ++col)
-            {
-                const QTableWidgetItem *tableItem = widget->item(row, col);
-                if (tableItem && tableItem != self)
-                {
-                    if (splitFunction == "sum=")
-                        sum += tableItem->text().toDouble();
-                    else
-                        prod *= tableItem->text().toDouble();
-                }
-            }
-        }
-
-        if (splitFunction == "sum=")
-            result = sum;
-        else
-            result = prod;
-    }
+    // Methods for 'sum=', 'product=', 'average=', 'stdev=' and the like.
+    if (formula.aggregate)
+        result = formula.aggregate(source, self, range);
     // Method for 'sqrt=' function.
-    else if (splitFunction == "sqrt=")
+    else if (formula.name == "sqrt=")
     {
-        int sqrRow = 0;
-        int sqrCol = 0;
-
-        decode_pos(list.value(1), &sqrRow, &sqrCol);
-        const QTableWidgetItem *sqrItem = widget->item(sqrRow, sqrCol);
+        const QTableWidgetItem *sqrItem = referencedItem(list.value(1), widget);
         double sqrResult = 0;
         QString sqrTemp = list.value(1);
-        sqrResult = sqrItem ? sqrItem->text().toDouble() : sqrTemp.toDouble();
+        sqrResult = sqrItem ? cellNumber(sqrItem) : sqrTemp.toDouble();
 
         result = qSqrt(sqrResult);
     }
-    // Methods for 'median=', 'min=', and 'max=' functions.
-    else if (splitFunction == "median=" || splitFunction == "min=" || splitFunction == "max=")
+    // Methods for 'match=' and 'vlookup=' functions.
+    else if (isLookup(formula.name))
+        result = lookupResult(formula, widget);
+    // Method for 'median=' function.
+    else if (formula.name == "median=")
     {
-        QVector<int> medStore;
-        for (int row = firstRow; row <= lastRow; ++row)
+        LeanScratch scratch;
+        QVector<double> &medStore = scratch.numbers();
+        for (int row = range.firstRow; row <= range.lastRow; ++row)
         {
-            for (int col = firstCol; col <= lastCol; ++col)
+            for (int col = range.firstCol; col <= range.lastCol; ++col)
             {
-                const QTableWidgetItem *tableItem = widget->item(row, col);
-                if (tableItem && tableItem != self)
-                    medStore.append(tableItem->text().toDouble());
+                const QTableWidgetItem *tableItem = source->item(row, col);
+                double value = 0;
+                if (tableItem && tableItem != self && numberOf(tableItem, &value))
+                    medStore.append(value);
             }
         }
 
         qSort(medStore);
 
-        if (splitFunction == "median=")
-        {
-            if (medStore.size() % 2)
-                result = medStore.at(medStore.count() / 2);
-            else
-                result = (medStore.at(medStore.count() / 2) + medStore.at((medStore.count() / 2) + 1))/2;
-        }
-        else if (splitFunction == "min=")
-            result = medStore.first();
-        else if (splitFunction == "max=")
-            result = medStore.last();
+        int half = medStore.count() / 2;
+        if (medStore.size() % 2)
+            result = medStore.at(half);
+        else if (!medStore.isEmpty())
+            result = (medStore.at(half - 1) + medStore.at(half)) / 2;
     }
-    // Method for 'average=' function.
-    else if (splitFunction == "average=")
-    {
-        double avgSum = 0;
-        double avgCount = 0;
-
-        for (int row = firstRow; row <= lastRow; ++row)
-        {
-            for (int col = firstCol; col <= lastCol; ++col)
-            {
-                const QTableWidgetItem *tableItem = widget->item(row, col);
-                if (tableItem && tableItem != self)
-                {
-                    avgSum += tableItem->text().toDouble();
-                    avgCount++;
-                }
-            }
-        }
+    else
+        result = list.join(' ');
 
-        result = avgSum / avgCount;
-    }
-    // Method for 'stdev=' function.
-    else if (splitFunction == "stdev=") {
-        double stdSum = 0;
-        double avgSum = 0;
-        double stdAvg = 0;
-        int stdCount = 0;
-
-        for (int row = firstRow; row <= lastRow; ++row)
-        {
-            for (int col = firstCol; col <= lastCol; ++col)
-            {
-                const QTableWidgetItem *tableItem = widget->item(row, col);
-                if (tableItem && tableItem != self)
-                {
-                    avgSum += tableItem->text().toDouble();
-                    stdCount++;
-                }
-            }
-        }
-        stdAvg = avgSum / stdCount;
+    return result;
+}
 
-        for (int row = firstRow; row <= lastRow; ++row)
-        {
-            for (int col = firstCol; col <= lastCol; ++col)
-            {
-                const QTableWidgetItem *tableItem = widget->item(row, col);
-                if (tableItem && tableItem != self)
-                    stdSum += qPow(tableItem->text().toDouble() - stdAvg, 2);
-            }
-        }
+void *LeanItem::operator new(size_t size)
+{
+    if (size != sizeof(LeanItem))
+        return ::operator new(size);
+    return LeanPool<sizeof(LeanItem)>::allocate();
+}
 
-        result = qSqrt(stdSum / (stdCount - 1));
-    }
+void LeanItem::operator delete(void *pointer, size_t size)
+{
+    if (!pointer)
+        return;
+    if (size != sizeof(LeanItem))
+        ::operator delete(pointer);
     else
-        result = function;
-
-    return result;
+        LeanPool<sizeof(LeanItem)>::release(pointer);
 }
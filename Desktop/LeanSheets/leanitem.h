@@ -2,20 +2,41 @@
 #define LEANITEM_H
 
 #include "leansheets.h"
+#include "leanformula.h"
 
+#include <QColor>
 #include <QTableWidgetItem>
 
+// What a cell looks like, worked out once per change rather than per paint.
+struct LeanRender
+{
+    QString text;
+    QColor color;
+    bool isNumber;
+};
+
 class LeanItem : public QTableWidgetItem
 {
 public:
+    // Item type reported by QTableWidgetItem::type() for every LeanItem.
+    enum { LeanType = QTableWidgetItem::UserType };
+
+    // What the text of a cell was classified as on its last edit.
+    // Spill cells show one result of the array formula above them.
+    enum CellType { Empty, Number, String, Formula, Error, Spill };
+
     LeanItem();
     LeanItem(const QString &text);
+    ~LeanItem();
 
+    LeanItem &operator=(const LeanItem &other);
     QTableWidgetItem *clone() const override;
 
     QVariant data(int role) const override;
     void setData(int role, const QVariant &value) override;
     QVariant display() const;
+    const LeanRender &render() const;
+    void markDirty() const;
 
     /** Copyright (C) 2016 The Qt Company Ltd. **/
     inline QString function() const
@@ -23,13 +44,58 @@ public:
         return QTableWidgetItem::data(Qt::DisplayRole).toString();
     }
 
+    inline CellType cellType() const { return typeTag; }
+    inline bool isComputed() const { return typeTag == Formula || typeTag == Spill; }
+    inline int spillOffset() const { return spill; }
+    inline const LeanFormula *compiled() const { return formula; }
+    double number() const;
+
+    bool isArray() const;
+    int arrayLength() const;
+    QVariant arrayValue(int offset) const;
+    inline bool isSpillBlocked() const { return spillBlocked; }
+    void setSpillBlocked(bool blocked);
+    static LeanItem *spillOf(int offset);
+
+    void shiftReferences(const QString &sheet, const QString &ownSheet,
+                         int atRow, int rows, int atCol, int cols);
+    void renameReferences(const QString &oldName, const QString &newName);
+
+    static double cellNumber(const QTableWidgetItem *item);
+    static QVariant cellValue(const QTableWidgetItem *item);
+    static bool numberOf(const QTableWidgetItem *item, double *value);
+    static bool isOperator(const QString &token);
+    static bool isFunction(const QString &token);
+    static bool isLookup(const QString &token);
+    static const QTableWidgetItem *referencedItem(const QString &token,
+                                                  const QTableWidget *widget,
+                                                  bool *isUnknownSheet = 0);
+
     static QVariant functionResult(const QString &formula,
                                    const QTableWidget *widget,
                                    const QTableWidgetItem *self = 0);
 
+    static void *operator new(size_t size);
+    static void operator delete(void *pointer, size_t size);
 
 private:
+    LeanItem(const LeanItem &other) = delete;
+
+    void classify(const QString &text);
+    bool isTracked() const;
+    static QVariant evaluate(const LeanFormula &formula,
+                             const QTableWidget *widget,
+                             const QTableWidgetItem *self);
+
+    CellType typeTag;
+    double numberValue;
+    LeanFormula *formula;
+    int spill;
+    bool spillBlocked;
+
     mutable bool isResolving;
+    mutable LeanRender rendered;
+    mutable bool isRendered;
 };
 
 #endif // LEANITEM_H
@@ -0,0 +1,237 @@
+#include "leanmapped.h"
+#include "leanpivot.h"
+#include "leansheets.h"
+
+#include <QtConcurrent>
+
+#include <cstring>
+#include <limits>
+
+LeanMappedModel::LeanMappedModel(QObject *parent)
+        : QAbstractTableModel(parent), bytes(nullptr), size(0), columns(0),
+          rows(0), indexedEnd(0), truncated(false), cancelled(0), decoded(DECODED_ROWS)
+{
+}
+
+LeanMappedModel::~LeanMappedModel()
+{
+    cancelled.store(1);
+    indexing.waitForFinished();
+}
+
+// Maps fileName and starts indexing its lines in the background.
+bool LeanMappedModel::open(const QString &fileName)
+{
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    size = file.size();
+    bytes = size ? reinterpret_cast<const char *>(file.map(0, size)) : nullptr;
+    if (size && !bytes)
+        return false;
+
+    // The first line decides how many columns there are.
+    const char *end = size ? static_cast<const char *>(std::memchr(bytes, '\n', size)) : nullptr;
+    QByteArray first = QByteArray::fromRawData(bytes, end ? end - bytes : size);
+    columns = size ? qMin(int(first.count(',')) + 1, ALPHA) : 0;
+
+    indexing = QtConcurrent::run(this, &LeanMappedModel::buildIndex);
+    return true;
+}
+
+// Runs on the thread pool: counts lines and records where every
+// INDEX_STRIDE-th one starts, in batches. A line is only handed over once
+// its end has been found, along with the offset that end is at, so no row
+// is ever read past what was indexed. Counting stops at INT_MAX lines,
+// the most rows a view can hold.
+void LeanMappedModel::buildIndex()
+{
+    const qint64 maxLines = std::numeric_limits<int>::max();
+    QVector<qint64> batch;
+    qint64 lines = 0;
+    int count = 0;
+    qint64 start = 0;
+    bool full = false;
+    while (start < size && !cancelled.load())
+    {
+        if (lines == maxLines)
+        {
+            full = true;
+            break;
+        }
+        const char *found = static_cast<const char *>(std::memchr(bytes + start, '\n', size_t(size - start)));
+        if (!found)
+            break;
+        if (lines % INDEX_STRIDE == 0)
+            batch.append(start);
+        lines++;
+        count++;
+        start = found - bytes + 1;
+
+        if (count >= INDEX_BATCH)
+        {
+            QMetaObject::invokeMethod(this, [this, batch, count, start]() { appendLines(batch, count, start, false, false); },
+                                      Qt::QueuedConnection);
+            batch.clear();
+            count = 0;
+        }
+    }
+
+    // The last line may end at the end of the file rather than with a break.
+    if (start < size && !full && !cancelled.load())
+    {
+        if (lines % INDEX_STRIDE == 0)
+            batch.append(start);
+        count++;
+        start = size;
+    }
+    QMetaObject::invokeMethod(this, [this, batch, count, start, full]() { appendLines(batch, count, start, true, full); },
+                              Qt::QueuedConnection);
+}
+
+// Back on the GUI thread: turns a batch of indexed lines into rows.
+void LeanMappedModel::appendLines(const QVector<qint64> &starts, int count, qint64 end, bool done, bool full)
+{
+    if (count)
+    {
+        beginInsertRows(QModelIndex(), rows, rows + count - 1);
+        checkpoints += starts;
+        rows += count;
+        indexedEnd = end;
+        endInsertRows();
+    }
+    truncated = full;
+    emit indexed(rows, done);
+}
+
+// Where a line starts: from the start of the last recorded line before
+// it, skipping the lines in between.
+qint64 LeanMappedModel::lineStart(int row) const
+{
+    qint64 start = checkpoints.at(row / INDEX_STRIDE);
+    for (int skip = row % INDEX_STRIDE; skip > 0; skip--)
+        start = nextLine(start);
+    return start;
+}
+
+// Where the line after the one at start begins, or the end of the index.
+qint64 LeanMappedModel::nextLine(qint64 start) const
+{
+    const char *found = static_cast<const char *>(std::memchr(bytes + start, '\n', size_t(indexedEnd - start)));
+    return found ? found - bytes + 1 : indexedEnd;
+}
+
+// The bytes from start up to end, without the line break they end with.
+QByteArray LeanMappedModel::text(qint64 start, qint64 end) const
+{
+    while (end > start && (bytes[end - 1] == '\n' || bytes[end - 1] == '\r'))
+        end--;
+
+    // A line longer than a QByteArray can hold is cut short.
+    qint64 length = qMin(end - start, qint64(std::numeric_limits<int>::max()));
+    return QByteArray::fromRawData(bytes + start, int(length));
+}
+
+// The bytes of a line, without its line break.
+QByteArray LeanMappedModel::line(int row) const
+{
+    qint64 start = lineStart(row);
+    return text(start, nextLine(start));
+}
+
+int LeanMappedModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows;
+}
+
+int LeanMappedModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : columns;
+}
+
+QVariant LeanMappedModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || (role != Qt::DisplayRole && role != Qt::EditRole))
+        return QVariant();
+
+    // Rows are decoded on demand and only the most recent ones are kept.
+    QStringList *fields = decoded.object(index.row());
+    if (!fields)
+    {
+        fields = new QStringList(QString::fromUtf8(line(index.row())).split(','));
+        decoded.insert(index.row(), fields);
+    }
+    return fields->value(index.column());
+}
+
+QVariant LeanMappedModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (role != Qt::DisplayRole)
+        return QVariant();
+    if (orientation == Qt::Horizontal)
+        return QString(QChar('A' + section));
+    return section + 1;
+}
+
+Qt::ItemFlags LeanMappedModel::flags(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return Qt::NoItemFlags;
+    return Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+}
+
+// Count, sum, average, min, max and stdev of the numbers in a column,
+// folded straight from the mapped bytes in parallel blocks of lines. Each
+// block finds its first line once and walks on from line to line.
+QString LeanMappedModel::columnSummary(int column) const
+{
+    struct Block
+    {
+        int first;
+        int last;
+        PivotOp::State state;
+    };
+
+    QVector<Block> blocks;
+    // Counted in 64 bits, since the last block may end near INT_MAX.
+    for (qint64 first = 0; first < rows; first += BLOCK_ROWS)
+        blocks.append(Block{ int(first), int(qMin(first + BLOCK_ROWS, qint64(rows)) - 1), PivotOp::init() });
+
+    QtConcurrent::blockingMap(blocks, [this, column](Block &block)
+    {
+        qint64 next = lineStart(block.first);
+        for (int row = block.first; row <= block.last; row++)
+        {
+            qint64 start = next;
+            next = nextLine(start);
+            QByteArray fields = text(start, next);
+            int at = 0;
+            for (int field = 0; field < column && at >= 0; field++)
+            {
+                at = fields.indexOf(',', at);
+                at = at < 0 ? -1 : at + 1;
+            }
+            if (at < 0)
+                continue;
+
+            int end = fields.indexOf(',', at);
+            bool isNumber = false;
+            double value = fields.mid(at, end < 0 ? -1 : end - at).toDouble(&isNumber);
+            if (isNumber)
+                PivotOp::accumulate(block.state, value);
+        }
+    });
+
+    PivotOp::State state = PivotOp::init();
+    for (const Block &block : blocks)
+        PivotOp::merge(state, block.state);
+
+    return tr("Count: %1  Sum: %2  Average: %3  Min: %4  Max: %5  Stdev: %6")
+            .arg(state.average.count)
+            .arg(SumOp::finalize(state.sum).toString())
+            .arg(AverageOp::finalize(state.average).toString())
+            .arg(MinOp::finalize(state.min).toString())
+            .arg(MaxOp::finalize(state.max).toString())
+            .arg(StdevOp::finalize(state.stdev).toString());
+}
@@ -0,0 +1,81 @@
+#ifndef LEANMAPPED_H
+#define LEANMAPPED_H
+
+#include <QAbstractTableModel>
+#include <QAtomicInt>
+#include <QCache>
+#include <QFile>
+#include <QFuture>
+#include <QStringList>
+#include <QVector>
+
+// Lines found by the background pass before they are handed over.
+#define INDEX_BATCH 262144
+// Only the start of every so many lines is recorded; the lines between
+// are found again by scanning forward from it.
+#define INDEX_STRIDE 256
+// Rows kept decoded for the view.
+#define DECODED_ROWS 4096
+
+/****************************************************************************
+** The LeanMappedModel class shows a comma separated file read-only,
+** straight from a memory mapping of it. A background pass records where
+** every INDEX_STRIDE-th line starts, adding rows to the model as it goes,
+** so the index stays small even for files of billions of short lines. A
+** row is only found and decoded into strings when the view asks for it.
+** Column summaries stream over the mapping without decoding anything
+** either. A view holds at most INT_MAX rows; lines past that are left out
+** and isTruncated() tells so.
+****************************************************************************/
+
+class LeanMappedModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    LeanMappedModel(QObject *parent = 0);
+    ~LeanMappedModel();
+
+    bool open(const QString &fileName);
+    inline QString errorString() const { return file.errorString(); }
+    inline QString fileName() const { return file.fileName(); }
+    inline bool isTruncated() const { return truncated; }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation,
+                        int role = Qt::DisplayRole) const override;
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+
+    QString columnSummary(int column) const;
+
+signals:
+    void indexed(qint64 lines, bool done);
+
+private:
+    void buildIndex();
+    void appendLines(const QVector<qint64> &starts, int count, qint64 end, bool done, bool full);
+    qint64 lineStart(int row) const;
+    qint64 nextLine(qint64 start) const;
+    QByteArray text(qint64 start, qint64 end) const;
+    QByteArray line(int row) const;
+
+    QFile file;
+    const char *bytes;
+    qint64 size;
+    int columns;
+
+    // Where every INDEX_STRIDE-th indexed line starts, how many lines were
+    // indexed, and where the last of them ends.
+    QVector<qint64> checkpoints;
+    int rows;
+    qint64 indexedEnd;
+    bool truncated;
+    QFuture<void> indexing;
+    QAtomicInt cancelled;
+
+    mutable QCache<int, QStringList> decoded;
+};
+
+#endif // LEANMAPPED_H
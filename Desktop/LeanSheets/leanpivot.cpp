@@ -0,0 +1,443 @@
+#include "leanpivot.h"
+#include "leantable.h"
+#include "leanworkbook.h"
+
+#include <QTableWidget>
+
+#include <algorithm>
+
+// Separates the key columns of a group; it never appears in typed text.
+#define KEY_SEPARATOR QChar(0x1f)
+
+namespace {
+
+// One block of rows of the first pass and the groups it found.
+struct PivotPartial
+{
+    int first;
+    int last;
+    QHash<QString, PivotOp::State> groups;
+    QHash<QString, QVector<int> > rows;
+};
+
+}
+
+LeanPivot::LeanPivot(QTableWidget *table, QTableWidget *output, const QVector<int> &keyColumns,
+                     int valueColumn, int firstRow, int lastRow, bool growsWithAppends,
+                     QObject *parent)
+        : QObject(parent), table(table), output(output), keyColumns(keyColumns),
+          valueColumn(valueColumn), firstRow(firstRow), lastRow(lastRow),
+          growsWithAppends(growsWithAppends)
+{
+    // A sheet reports a batch of writes, such as rows appended to a followed
+    // file, as one block rather than cell by cell.
+    QAbstractItemModel *source = table->model();
+    LeanTable *sheet = qobject_cast<LeanTable *>(table);
+    if (sheet)
+        connect(sheet, &LeanTable::cellsUpdated, this, &LeanPivot::cellsUpdated);
+    else
+        connect(source, &QAbstractItemModel::dataChanged, this, &LeanPivot::cellsChanged);
+    connect(source, &QAbstractItemModel::rowsInserted, this, &LeanPivot::rowsAdded);
+    connect(source, &QAbstractItemModel::rowsRemoved, this, &LeanPivot::rowsDropped);
+    connect(source, &QAbstractItemModel::columnsInserted, this, &LeanPivot::rebuild);
+    connect(source, &QAbstractItemModel::columnsRemoved, this, &LeanPivot::rebuild);
+    connect(source, &QAbstractItemModel::modelReset, this, &LeanPivot::rebuild);
+
+    // Formula results change without their cells being edited.
+    if (sheet && sheet->workbook())
+    {
+        book = sheet->workbook();
+        connect(book, &LeanWorkbook::recalculated, this, &LeanPivot::cellsRecalculated);
+    }
+
+    rebuild();
+}
+
+// The key of a group from the texts of its key columns, or an empty
+// string when they are all empty. It touches no cell, so any thread may
+// build keys.
+QString LeanPivot::keyOf(const QString *texts, int count)
+{
+    bool empty = true;
+    int length = count - 1;
+    for (int index = 0; index < count; index++)
+    {
+        empty = empty && texts[index].isEmpty();
+        length += texts[index].size();
+    }
+    if (empty)
+        return QString();
+
+    QString key;
+    key.reserve(length);
+    for (int index = 0; index < count; index++)
+    {
+        if (index)
+            key += KEY_SEPARATOR;
+        key += texts[index];
+    }
+    return key;
+}
+
+// The key of the group a row belongs to, or an empty string for none.
+QString LeanPivot::groupOf(int row) const
+{
+    QVector<QString> texts(keyColumns.size());
+    for (int index = 0; index < keyColumns.size(); index++)
+    {
+        const QTableWidgetItem *cur = table->item(row, keyColumns.at(index));
+        if (cur)
+            texts[index] = cur->text();
+    }
+    return keyOf(texts.constData(), texts.size());
+}
+
+// Groups every row from scratch. Only reading the cells stays on this
+// thread; keys are built and rows hashed in blocks on the thread pool.
+void LeanPivot::rebuild()
+{
+    // Only a reset can leave the range past the end of the sheet.
+    lastRow = qMin(lastRow, table->rowCount() - 1);
+    int count = qMax(0, lastRow - firstRow + 1);
+
+    // Cells are read on this thread, since formulas may need evaluating,
+    // into plain buffers that the tasks below share without locking. No
+    // cell lies past the used rows of a sheet, so those are not read.
+    int read = count;
+    LeanTable *sheet = qobject_cast<LeanTable *>(table);
+    if (sheet)
+        read = qBound(0, sheet->usedRows() - firstRow, count);
+
+    int width = keyColumns.size();
+    QVector<QString> texts(read * width);
+    QVector<double> values(read);
+    QVector<bool> hasValue(read);
+    for (int index = 0; index < read; index++)
+    {
+        int row = firstRow + index;
+        for (int key = 0; key < width; key++)
+        {
+            const QTableWidgetItem *cur = table->item(row, keyColumns.at(key));
+            if (cur)
+                texts[index * width + key] = cur->text();
+        }
+        const QTableWidgetItem *cur = table->item(row, valueColumn);
+        double value = 0;
+        hasValue[index] = cur && LeanItem::numberOf(cur, &value);
+        values[index] = value;
+    }
+
+    rowGroups.fill(QString(), count);
+    QVector<PivotPartial> partials;
+    for (int first = 0; first < read; first += PIVOT_BLOCK_ROWS)
+        partials.append(PivotPartial{ first, qMin(first + PIVOT_BLOCK_ROWS, read) - 1,
+                                      QHash<QString, PivotOp::State>(), QHash<QString, QVector<int> >() });
+
+    // Each task writes the keys of its own rows only.
+    QString *keys = rowGroups.data();
+    const QString *cells = texts.constData();
+    QtConcurrent::blockingMap(partials, [keys, cells, width, &values, &hasValue](PivotPartial &partial)
+    {
+        for (int index = partial.first; index <= partial.last; index++)
+        {
+            QString key = keyOf(cells + index * width, width);
+            if (key.isEmpty())
+                continue;
+            keys[index] = key;
+
+            QHash<QString, PivotOp::State>::iterator group = partial.groups.find(key);
+            if (group == partial.groups.end())
+                group = partial.groups.insert(key, PivotOp::init());
+            if (hasValue.at(index))
+                PivotOp::accumulate(*group, values.at(index));
+            partial.rows[key].append(index);
+        }
+    });
+
+    // Merging in block order keeps the rows of every group sorted.
+    groups.clear();
+    groupRows.clear();
+    for (const PivotPartial &partial : partials)
+    {
+        for (QHash<QString, PivotOp::State>::const_iterator group = partial.groups.constBegin();
+             group != partial.groups.constEnd(); ++group)
+        {
+            QMap<QString, PivotOp::State>::iterator merged = groups.find(group.key());
+            if (merged == groups.end())
+                groups.insert(group.key(), group.value());
+            else
+                PivotOp::merge(*merged, group.value());
+            groupRows[group.key()] += partial.rows.value(group.key());
+        }
+    }
+
+    render();
+}
+
+// Rows inserted above the range move it down; rows inserted within it
+// join it, and are added to their groups as they are. Rows added right
+// after it only join when the range grows with appends.
+void LeanPivot::rowsAdded(const QModelIndex &, int first, int last)
+{
+    int count = last - first + 1;
+    if (first < firstRow)
+    {
+        firstRow += count;
+        lastRow += count;
+        return;
+    }
+    if (first > lastRow + (growsWithAppends ? 1 : 0))
+        return;
+
+    int at = first - firstRow;
+    if (at < rowGroups.size())
+    {
+        for (QVector<int> &rows : groupRows)
+        {
+            for (int &offset : rows)
+            {
+                if (offset >= at)
+                    offset += count;
+            }
+        }
+    }
+    rowGroups.insert(at, count, QString());
+    lastRow += count;
+
+    QSet<QString> changed;
+    for (int offset = at; offset < at + count; offset++)
+    {
+        QString group = groupOf(firstRow + offset);
+        if (group.isEmpty())
+            continue;
+        rowGroups[offset] = group;
+        addRow(group, offset);
+        changed.insert(group);
+    }
+    renderGroups(changed);
+}
+
+// Puts a row into a group and folds its value into what the group holds.
+void LeanPivot::addRow(const QString &group, int offset)
+{
+    QVector<int> &rows = groupRows[group];
+    rows.insert(std::lower_bound(rows.begin(), rows.end(), offset), offset);
+
+    QMap<QString, PivotOp::State>::iterator state = groups.find(group);
+    if (state == groups.end())
+        state = groups.insert(group, PivotOp::init());
+    const QTableWidgetItem *cur = table->item(firstRow + offset, valueColumn);
+    double value = 0;
+    if (cur && LeanItem::numberOf(cur, &value))
+        PivotOp::accumulate(*state, value);
+}
+
+// Rows removed above the range move it up; rows removed within it leave
+// it, and their groups are folded again without them.
+void LeanPivot::rowsDropped(const QModelIndex &, int first, int last)
+{
+    int above = qMax(0, qMin(last, firstRow - 1) - first + 1);
+    int from = qMax(first, firstRow);
+    int count = qMax(0, qMin(last, lastRow) - from + 1);
+    if (!count)
+    {
+        firstRow -= above;
+        lastRow -= above;
+        return;
+    }
+
+    int at = from - firstRow;
+    QSet<QString> dirty;
+    for (int offset = at; offset < at + count; offset++)
+        dirty.insert(rowGroups.at(offset));
+    dirty.remove(QString());
+    rowGroups.remove(at, count);
+
+    for (QVector<int> &rows : groupRows)
+    {
+        rows.erase(std::remove_if(rows.begin(), rows.end(),
+                                  [at, count](int offset) { return offset >= at && offset < at + count; }),
+                   rows.end());
+        for (int &offset : rows)
+        {
+            if (offset >= at + count)
+                offset -= count;
+        }
+    }
+    for (const QString &group : dirty)
+    {
+        if (groupRows.value(group).isEmpty())
+            groupRows.remove(group);
+    }
+
+    firstRow -= above;
+    lastRow -= above + count;
+    for (const QString &group : dirty)
+        refold(group);
+    renderGroups(dirty);
+}
+
+// Edits made while the workbook reports its results are those results,
+// which arrive once per sheet through cellsRecalculated().
+void LeanPivot::cellsChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    if (book && book->isRecalculating())
+        return;
+    regroup(topLeft.row(), topLeft.column(), bottomRight.row(), bottomRight.column());
+}
+
+void LeanPivot::cellsUpdated(int top, int left, int bottom, int right)
+{
+    if (book && book->isRecalculating())
+        return;
+    regroup(top, left, bottom, right);
+}
+
+void LeanPivot::cellsRecalculated(const QTableWidget *sheet, int top, int left, int bottom, int right)
+{
+    if (sheet == table)
+        regroup(top, left, bottom, right);
+}
+
+// Moves changed rows between groups. Rows joining a group are folded into
+// it as they are, while groups that lost a row or saw one change are folded
+// again, so that rows appended to a followed file cost only themselves.
+void LeanPivot::regroup(int top, int left, int bottom, int right)
+{
+    bool isRead = valueColumn >= left && valueColumn <= right;
+    for (int col : keyColumns)
+        isRead = isRead || (col >= left && col <= right);
+    if (!isRead)
+        return;
+
+    QSet<QString> dirty;
+    QSet<QString> changed;
+    for (int row = qMax(top, firstRow); row <= qMin(bottom, lastRow); row++)
+    {
+        int offset = row - firstRow;
+        QString oldGroup = rowGroups.at(offset);
+        QString newGroup = groupOf(row);
+        if (oldGroup == newGroup)
+        {
+            dirty.insert(newGroup);
+            continue;
+        }
+
+        rowGroups[offset] = newGroup;
+        if (!oldGroup.isEmpty())
+        {
+            QVector<int> &rows = groupRows[oldGroup];
+            rows.erase(std::lower_bound(rows.begin(), rows.end(), offset));
+            if (rows.isEmpty())
+                groupRows.remove(oldGroup);
+            dirty.insert(oldGroup);
+        }
+        if (!newGroup.isEmpty())
+        {
+            addRow(newGroup, offset);
+            changed.insert(newGroup);
+        }
+    }
+
+    dirty.remove(QString());
+    for (const QString &group : dirty)
+        refold(group);
+    changed += dirty;
+    if (!changed.isEmpty())
+        renderGroups(changed);
+}
+
+// Folds the rows of one group again, or drops it once it has none.
+void LeanPivot::refold(const QString &group)
+{
+    if (!groupRows.contains(group))
+    {
+        groups.remove(group);
+        return;
+    }
+
+    PivotOp::State state = PivotOp::init();
+    for (int offset : groupRows.value(group))
+    {
+        const QTableWidgetItem *cur = table->item(firstRow + offset, valueColumn);
+        double value = 0;
+        if (cur && LeanItem::numberOf(cur, &value))
+            PivotOp::accumulate(state, value);
+    }
+    groups.insert(group, state);
+}
+
+// Writes one row per group: its keys, then count, sum, average, min, max
+// and stdev of the value column.
+void LeanPivot::render()
+{
+    QStringList headers;
+    for (int col : keyColumns)
+        headers.append(QString(QChar('A' + col)));
+    headers << tr("Count") << tr("Sum") << tr("Average") << tr("Min") << tr("Max") << tr("Stdev");
+
+    output->clear();
+    output->setColumnCount(headers.size());
+    output->setRowCount(groups.size());
+    output->setHorizontalHeaderLabels(headers);
+
+    shown = groups.keys();
+    int row = 0;
+    for (QMap<QString, PivotOp::State>::const_iterator group = groups.constBegin();
+         group != groups.constEnd(); ++group, ++row)
+        writeGroup(row, group.key(), group.value());
+}
+
+// Rewrites the rows of the given groups only, inserting or removing rows
+// of the output for groups that appeared or went.
+void LeanPivot::renderGroups(const QSet<QString> &changed)
+{
+    QStringList sorted = changed.values();
+    std::sort(sorted.begin(), sorted.end());
+
+    for (const QString &group : sorted)
+    {
+        QStringList::iterator at = std::lower_bound(shown.begin(), shown.end(), group);
+        int row = at - shown.begin();
+        bool isShown = at != shown.end() && *at == group;
+
+        QMap<QString, PivotOp::State>::const_iterator state = groups.constFind(group);
+        if (state == groups.constEnd())
+        {
+            if (isShown)
+            {
+                shown.removeAt(row);
+                output->removeRow(row);
+            }
+            continue;
+        }
+        if (!isShown)
+        {
+            shown.insert(row, group);
+            output->insertRow(row);
+        }
+        writeGroup(row, group, state.value());
+    }
+}
+
+void LeanPivot::writeGroup(int row, const QString &group, const PivotOp::State &state)
+{
+    QVector<QVariant> cells;
+    for (const QString &key : group.split(KEY_SEPARATOR))
+        cells.append(key);
+    cells << double(state.average.count) << SumOp::finalize(state.sum)
+          << AverageOp::finalize(state.average) << MinOp::finalize(state.min)
+          << MaxOp::finalize(state.max) << StdevOp::finalize(state.stdev);
+
+    for (int col = 0; col < cells.size(); col++)
+    {
+        QTableWidgetItem *cur = output->item(row, col);
+        if (!cur)
+        {
+            cur = new QTableWidgetItem();
+            cur->setFlags(cur->flags() & ~Qt::ItemIsEditable);
+            output->setItem(row, col, cur);
+        }
+        cur->setData(Qt::DisplayRole, cells.at(col));
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef LEANPIVOT_H
+#define LEANPIVOT_H
+
+#include "leanaggregate.h"
+
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+class QTableWidget;
+class LeanWorkbook;
+
+// Rows handed to each task of a parallel pivot.
+#define PIVOT_BLOCK_ROWS 16384
+
+// Every statistic a pivot shows for one group, folded in a single pass
+// from the same policies the aggregate functions use.
+struct PivotOp
+{
+    struct State
+    {
+        SumOp::State sum;
+        AverageOp::State average;
+        MinOp::State min;
+        MaxOp::State max;
+        StdevOp::State stdev;
+    };
+
+    static State init()
+    {
+        return State{ SumOp::init(), AverageOp::init(), MinOp::init(), MaxOp::init(), StdevOp::init() };
+    }
+    static void accumulate(State &s, double value)
+    {
+        SumOp::accumulate(s.sum, value);
+        AverageOp::accumulate(s.average, value);
+        MinOp::accumulate(s.min, value);
+        MaxOp::accumulate(s.max, value);
+        StdevOp::accumulate(s.stdev, value);
+    }
+    static void merge(State &s, const State &other)
+    {
+        SumOp::merge(s.sum, other.sum);
+        AverageOp::merge(s.average, other.average);
+        MinOp::merge(s.min, other.min);
+        MaxOp::merge(s.max, other.max);
+        StdevOp::merge(s.stdev, other.stdev);
+    }
+};
+
+/****************************************************************************
+** The LeanPivot class groups the rows of a sheet by the text of one or
+** more key columns and summarises a value column per group into an output
+** table. The first pass reads the cells into plain buffers, then builds
+** the keys and hashes blocks of rows on the thread pool, each into its own
+** table of groups, and merges them in order. Afterwards only the groups
+** touched by an edited or recalculated cell are folded again, and only
+** their rows of the output are written. The range of rows moves with rows
+** inserted into the sheet and takes in those inserted within it. Rows
+** added right after it only join when it was set up to grow with appends,
+** as a pivot over the whole of a followed sheet is.
+****************************************************************************/
+
+class LeanPivot : public QObject
+{
+    Q_OBJECT
+
+public:
+    LeanPivot(QTableWidget *table, QTableWidget *output, const QVector<int> &keyColumns,
+              int valueColumn, int firstRow, int lastRow, bool growsWithAppends,
+              QObject *parent = 0);
+
+public slots:
+    void rebuild();
+
+private slots:
+    void cellsChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void cellsUpdated(int top, int left, int bottom, int right);
+    void cellsRecalculated(const QTableWidget *sheet, int top, int left, int bottom, int right);
+    void rowsAdded(const QModelIndex &parent, int first, int last);
+    void rowsDropped(const QModelIndex &parent, int first, int last);
+
+private:
+    static QString keyOf(const QString *texts, int count);
+    QString groupOf(int row) const;
+    void regroup(int top, int left, int bottom, int right);
+    void addRow(const QString &group, int offset);
+    void refold(const QString &group);
+    void render();
+    void renderGroups(const QSet<QString> &changed);
+    void writeGroup(int row, const QString &group, const PivotOp::State &state);
+
+    QTableWidget *table;
+    QPointer<LeanWorkbook> book;
+    QTableWidget *output;
+    QVector<int> keyColumns;
+    int valueColumn;
+    int firstRow;
+    int lastRow;
+    bool growsWithAppends;
+
+    // Rows are kept as offsets from firstRow, so that rows inserted above
+    // the range only have to move firstRow.
+    QVector<QString> rowGroups;
+    QHash<QString, QVector<int> > groupRows;
+    QMap<QString, PivotOp::State> groups;
+    QStringList shown;
+};
+
+#endif // LEANPIVOT_H
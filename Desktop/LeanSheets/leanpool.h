@@ -0,0 +1,119 @@
+#ifndef LEANPOOL_H
+#define LEANPOOL_H
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QVector>
+
+#include <new>
+
+// Blocks carved out of every slab a pool allocates.
+#define SLAB_BLOCKS 4096
+
+/****************************************************************************
+** LeanPool hands out fixed-size blocks carved from large slabs, so that
+** the objects of cells and compiled formulas never go through malloc one
+** at a time. What they hold, such as the text and data of a cell or the
+** tokens of a formula, is still allocated by Qt as usual.
+** Released blocks are threaded onto a free list and reused by the next
+** allocation; slabs themselves live as long as the program. There is one
+** pool per block size rather than per sheet, and it is not locked: it may
+** only be used from the GUI thread, which debug builds assert.
+****************************************************************************/
+
+template <size_t Size>
+class LeanPool
+{
+public:
+    static void *allocate()
+    {
+        Q_ASSERT(isGuiThread());
+        Block *&freeBlocks = freeList();
+        if (!freeBlocks)
+            grow();
+
+        Block *block = freeBlocks;
+        freeBlocks = block->next;
+        return block;
+    }
+
+    static void release(void *pointer)
+    {
+        Q_ASSERT(isGuiThread());
+        Block *block = static_cast<Block *>(pointer);
+        block->next = freeList();
+        freeList() = block;
+    }
+
+private:
+    union Block
+    {
+        Block *next;
+        double align;
+        char bytes[Size];
+    };
+
+    static bool isGuiThread()
+    {
+        QCoreApplication *application = QCoreApplication::instance();
+        return !application || QThread::currentThread() == application->thread();
+    }
+
+    static Block *&freeList()
+    {
+        static Block *freeBlocks = nullptr;
+        return freeBlocks;
+    }
+
+    static void grow()
+    {
+        Block *slab = static_cast<Block *>(::operator new(sizeof(Block) * SLAB_BLOCKS));
+        for (int index = SLAB_BLOCKS - 1; index >= 0; --index)
+            release(slab + index);
+    }
+};
+
+/****************************************************************************
+** LeanScratch lends out a vector that keeps its capacity between
+** evaluations, so temporaries such as the values collected by median=
+** are not reallocated on every repaint. Formulas may nest, so each level
+** of evaluation gets its own buffer.
+****************************************************************************/
+
+class LeanScratch
+{
+public:
+    LeanScratch()
+    {
+        if (buffers().size() <= depth())
+            buffers().append(new QVector<double>());
+        buffer = buffers().at(depth()++);
+        buffer->resize(0);
+    }
+
+    ~LeanScratch()
+    {
+        depth()--;
+    }
+
+    inline QVector<double> &numbers() { return *buffer; }
+
+private:
+    Q_DISABLE_COPY(LeanScratch)
+
+    static QVector<QVector<double> *> &buffers()
+    {
+        static QVector<QVector<double> *> scratch;
+        return scratch;
+    }
+
+    static int &depth()
+    {
+        static int level = 0;
+        return level;
+    }
+
+    QVector<double> *buffer;
+};
+
+#endif // LEANPOOL_H
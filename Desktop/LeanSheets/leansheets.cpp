@@ -1,13 +1,19 @@
 #include "leansheets.h"
 #include "leandelegate.h"
+#include "leanfollow.h"
 #include "leanitem.h"
-
-#define ALPHA 26
+#include "leanmapped.h"
+#include "leanpivot.h"
+#include "leansort.h"
+#include "leantable.h"
+#include "leanworkbook.h"
 
 /****************************************************************************
 ** The LeanSheets class encapsulates the data used to run the
 ** graphical interface of LeanSheets. Much attention should be paid to
 ** the QTableWidget 'table' which is the basis of spreadsheet functionality.
+** Each sheet of the workbook is one such table in a tab; 'table' is the
+** sheet on the current tab, which every menu operation works on.
 ** The majority of the functions in this class represent operations
 ** defined in the various menus of the program.
 ****************************************************************************/
@@ -16,6 +22,16 @@ LeanSheet::LeanSheet(int rows, int cols, QWidget *parent)
         : QMainWindow(parent)
 {
     curFile = nullptr;
+    sortedView = nullptr;
+    sortProxy = nullptr;
+    mappedView = nullptr;
+    mappedModel = nullptr;
+    pivotDock = nullptr;
+    pivotOutput = nullptr;
+    pivotEngine = nullptr;
+    follower = nullptr;
+    followedSheet = nullptr;
+    followedRows = 0;
 
     addToolBar(toolBar = new QToolBar());
     formulaInput = new QLineEdit();
@@ -26,39 +42,65 @@ LeanSheet::LeanSheet(int rows, int cols, QWidget *parent)
     toolBar->addWidget(cellLabel);
     toolBar->addWidget(formulaInput);
 
-    table = new QTableWidget(rows, cols, this);
-    table->setSizeAdjustPolicy(QTableWidget::AdjustToContents);
+    sheetRows = rows;
+    sheetCols = cols;
+    workbook = new LeanWorkbook(this);
+    tabs = new QTabWidget();
+    tabs->setTabPosition(QTabWidget::South);
+    table = createSheet(tr("Sheet1"));
+    startupPhase("sheet created");
+
+    createActions();
+    setupMenuBar();
+    startupPhase("menus created");
+
+    // The sorted view is only stacked on top once it is first needed.
+    views = new QStackedWidget();
+    views->addWidget(tabs);
+    setCentralWidget(views);
+    connect(views, &QStackedWidget::currentChanged, this, &LeanSheet::followCursor);
+
+    // Connects functions which allow the user to manipulate cells.
+    statusBar();
+    connect(formulaInput, &QLineEdit::returnPressed, this, &LeanSheet::returnPressed);
+    connect(tabs, &QTabWidget::currentChanged, this, &LeanSheet::showSheet);
+    connect(tabs, &QTabWidget::tabBarDoubleClicked, this, &LeanSheet::renameSheet);
+
+    setWindowTitle(tr("LeanSheets"));
+    // If "Logo.png" does not appear, resource directory may be misconfigured.
+    setWindowIcon(QIcon(":/Logo/Logo.png"));
+}
+
+// Creates an empty sheet in a new tab of the workbook.
+LeanTable *LeanSheet::createSheet(const QString &name)
+{
+    LeanTable *sheet = new LeanTable(sheetRows, sheetCols);
+    sheet->setSizeAdjustPolicy(QTableWidget::AdjustToContents);
 
     // Names each column starting with 'A'
-    for (int c = 0; c < cols; ++c)
+    for (int c = 0; c < sheetCols; ++c)
     {
         QString character(QChar('A' + c));
-        table->setHorizontalHeaderItem(c, new QTableWidgetItem(character));
+        sheet->setHorizontalHeaderItem(c, new QTableWidgetItem(character));
     }
 
-    table->setItemPrototype(table->item(rows - 1, cols - 1));
-    table->setItemDelegate(new LeanDelegate());
+    // No cell is allocated up front: cells that have never been edited
+    // stay empty until the view asks the prototype for a new one.
+    sheet->setItemPrototype(new LeanItem());
+    sheet->setItemDelegate(new LeanDelegate(sheet));
 
-    createActions();
-    setupMenuBar();
-    setupContents();
-    setCentralWidget(table);
-
-    // Connects functions which allow the user to manipulate cells.
-    statusBar();
-    connect(table, &QTableWidget::currentItemChanged,
+    connect(sheet, &QTableWidget::currentItemChanged,
             this, &LeanSheet::updateStatus);
-    connect(table, &QTableWidget::currentItemChanged,
+    connect(sheet, &QTableWidget::currentItemChanged,
             this, &LeanSheet::updateLineEdit);
-    connect(table, &QTableWidget::itemChanged,
+    connect(sheet, &QTableWidget::itemChanged,
             this, &LeanSheet::updateStatus);
-    connect(formulaInput, &QLineEdit::returnPressed, this, &LeanSheet::returnPressed);
-    connect(table, &QTableWidget::itemChanged,
+    connect(sheet, &QTableWidget::itemChanged,
             this, &LeanSheet::updateLineEdit);
 
-    setWindowTitle(tr("LeanSheets"));
-    // If "Logo.png" does not appear, resource directory may be misconfigured.
-    setWindowIcon(QIcon(":/Logo/Logo.png"));
+    workbook->addSheet(sheet, name);
+    tabs->addTab(sheet, name);
+    return sheet;
 }
 
 void LeanSheet::createActions()
@@ -67,6 +109,12 @@ void LeanSheet::createActions()
     openAction = new QAction(tr("Open"), this);
     connect(openAction, &QAction::triggered, this, &LeanSheet::openFile);
 
+    openReadOnlyAction = new QAction(tr("Open Read-Only"), this);
+    connect(openReadOnlyAction, &QAction::triggered, this, &LeanSheet::openReadOnly);
+
+    followAction = new QAction(tr("Follow File"), this);
+    connect(followAction, &QAction::triggered, this, &LeanSheet::followFile);
+
     saveAction = new QAction(tr("Save"), this);
     connect(saveAction, &QAction::triggered, this, &LeanSheet::saveFile);
 
@@ -83,6 +131,9 @@ void LeanSheet::createActions()
     colInsert = new QAction(tr("Column"), this);
     connect(colInsert, &QAction::triggered, this, &LeanSheet::insertCol);
 
+    sheetInsert = new QAction(tr("Sheet"), this);
+    connect(sheetInsert, &QAction::triggered, this, &LeanSheet::insertSheet);
+
     // Connects Edit Actions
     cutAction = new QAction(tr("Cut"), this);
     cutAction->setShortcut(QKeySequence(QKeySequence::Cut));
@@ -96,17 +147,11 @@ void LeanSheet::createActions()
     pasteAction->setShortcut(QKeySequence(QKeySequence::Paste));
     connect(pasteAction, &QAction::triggered, this, &LeanSheet::paste);
 
-    // Connects Help Actions
-    functionList = new QAction(tr("Functions"), this);
-    functionList->setShortcut(QKeySequence(QKeySequence::Find));
-    connect(functionList, &QAction::triggered, this, &LeanSheet::showFunctions);
-
-    operatorList = new QAction(tr("Operators"), this);
-    operatorList->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_E));
-    connect(operatorList, &QAction::triggered, this, &LeanSheet::showOperators);
-
-    aboutLeanSheets = new QAction(tr("About Leansheets"), this);
-    connect(aboutLeanSheets, &QAction::triggered, this, &LeanSheet::showAbout);
+    // The Help menu is built when first opened, but its shortcuts work from the start.
+    connect(new QShortcut(QKeySequence(QKeySequence::Find), this), &QShortcut::activated,
+            this, &LeanSheet::showFunctions);
+    connect(new QShortcut(QKeySequence(Qt::CTRL + Qt::Key_E), this), &QShortcut::activated,
+            this, &LeanSheet::showOperators);
 }
 
 void LeanSheet::setupMenuBar()
@@ -114,6 +159,8 @@ void LeanSheet::setupMenuBar()
     // Sets up File operations
     QMenu *fileMenu = menuBar()->addMenu(tr("&File"));
     fileMenu->addAction(openAction);
+    fileMenu->addAction(openReadOnlyAction);
+    fileMenu->addAction(followAction);
     fileMenu->addAction(saveAction);
     fileMenu->addAction(saveAsAction);
     fileMenu->addAction(exitAction);
@@ -130,9 +177,75 @@ void LeanSheet::setupMenuBar()
     insertMenu->addSeparator();
     insertMenu->addAction(rowInsert);
     insertMenu->addAction(colInsert);
+    insertMenu->addAction(sheetInsert);
+
+    // The Data and Help menus are only filled in the first time they open.
+    dataMenu = menuBar()->addMenu(tr("&Data"));
+    connect(dataMenu, &QMenu::aboutToShow, this, &LeanSheet::setupDataMenu);
+
+    helpMenu = menuBar()->addMenu(tr("&Help"));
+    connect(helpMenu, &QMenu::aboutToShow, this, &LeanSheet::setupHelpMenu);
+}
+
+void LeanSheet::setupDataMenu()
+{
+    if (!dataMenu->isEmpty())
+        return;
+
+    // Connects Data Actions
+    sortAscAction = new QAction(tr("Sort Ascending"), this);
+    connect(sortAscAction, &QAction::triggered, this, &LeanSheet::sortAscending);
+
+    sortDescAction = new QAction(tr("Sort Descending"), this);
+    connect(sortDescAction, &QAction::triggered, this, &LeanSheet::sortDescending);
+
+    thenAscAction = new QAction(tr("Then By Ascending"), this);
+    connect(thenAscAction, &QAction::triggered, this, &LeanSheet::thenAscending);
+
+    thenDescAction = new QAction(tr("Then By Descending"), this);
+    connect(thenDescAction, &QAction::triggered, this, &LeanSheet::thenDescending);
+
+    filterAction = new QAction(tr("Filter By Cell"), this);
+    connect(filterAction, &QAction::triggered, this, &LeanSheet::filterByCell);
+
+    showAllAction = new QAction(tr("Show All"), this);
+    connect(showAllAction, &QAction::triggered, this, &LeanSheet::showAll);
+
+    pivotAction = new QAction(tr("Pivot"), this);
+    connect(pivotAction, &QAction::triggered, this, &LeanSheet::pivot);
+
+    // Sets up Data operations
+    dataMenu->addSeparator();
+    dataMenu->addAction(sortAscAction);
+    dataMenu->addAction(sortDescAction);
+    dataMenu->addAction(thenAscAction);
+    dataMenu->addAction(thenDescAction);
+    dataMenu->addSeparator();
+    dataMenu->addAction(filterAction);
+    dataMenu->addAction(showAllAction);
+    dataMenu->addSeparator();
+    dataMenu->addAction(pivotAction);
+}
+
+void LeanSheet::setupHelpMenu()
+{
+    if (!helpMenu->isEmpty())
+        return;
+
+    // Connects Help Actions; their shortcuts belong to the window, so
+    // the menu only names them.
+    QString findKey = QKeySequence(QKeySequence::Find).toString(QKeySequence::NativeText);
+    functionList = new QAction(tr("Functions") + '\t' + findKey, this);
+    connect(functionList, &QAction::triggered, this, &LeanSheet::showFunctions);
+
+    QString operatorKey = QKeySequence(Qt::CTRL + Qt::Key_E).toString(QKeySequence::NativeText);
+    operatorList = new QAction(tr("Operators") + '\t' + operatorKey, this);
+    connect(operatorList, &QAction::triggered, this, &LeanSheet::showOperators);
+
+    aboutLeanSheets = new QAction(tr("About Leansheets"), this);
+    connect(aboutLeanSheets, &QAction::triggered, this, &LeanSheet::showAbout);
 
     // Sets up Help operations
-    QMenu *helpMenu = menuBar()->addMenu(tr("&Help"));
     helpMenu->addSeparator();
     helpMenu->addAction(functionList);
     helpMenu->addAction(operatorList);
@@ -142,7 +255,7 @@ void LeanSheet::setupMenuBar()
 /** Copyright (C) 2016 The Qt Company Ltd. **/
 void LeanSheet::updateStatus(QTableWidgetItem *item)
 {
-    if (item && item == table->currentItem())
+    if (item && item == currentSourceItem())
     {
         statusBar()->showMessage(item->data(Qt::StatusTipRole).toString(), 1000);
         cellLabel->setText(tr("Cell: (%1)").arg(encode_pos(table->row(item), table->column(item))));
@@ -152,7 +265,7 @@ void LeanSheet::updateStatus(QTableWidgetItem *item)
 /** Copyright (C) 2016 The Qt Company Ltd. **/
 void LeanSheet::updateLineEdit(QTableWidgetItem *item)
 {
-    if (item != table->currentItem())
+    if (item != currentSourceItem())
         return;
     if (item)
         formulaInput->setText(item->data(Qt::EditRole).toString());
@@ -160,31 +273,36 @@ void LeanSheet::updateLineEdit(QTableWidgetItem *item)
         formulaInput->clear();
 }
 
+// Shows the cell under the cursor of whichever view is showing, since the
+// sorted view has a cursor of its own that the sheet does not follow.
+void LeanSheet::followCursor()
+{
+    QTableWidgetItem *item = currentSourceItem();
+    updateStatus(item);
+    updateLineEdit(item);
+}
+
 /** Copyright (C) 2016 The Qt Company Ltd. **/
 void LeanSheet::returnPressed()
 {
+    QModelIndex current = currentSourceIndex();
+    if (!current.isValid())
+        return;
+
     QString text = formulaInput->text();
-    int row = table->currentRow();
-    int col = table->currentColumn();
+    int row = current.row();
+    int col = current.column();
     QTableWidgetItem *item = table->item(row, col);
     if (!item)
         table->setItem(row, col, new LeanItem(text));
     else
         item->setData(Qt::EditRole, text);
-    table->viewport()->update();
 }
 
-// Sets the cells to empty QStrings.
+// Removes every cell, leaving the headers in place.
 void LeanSheet::clear()
 {
-    for (int row = 0; row < table->rowCount(); row++)
-    {
-        for (int col = 0; col < table->columnCount(); col++)
-        {
-            QTableWidgetItem *cur = table->item(row, col);
-            cur->setText("");
-        }
-    }
+    table->clearContents();
 }
 
 // Opens files chosen by the user.
@@ -193,36 +311,216 @@ void LeanSheet::openFile()
     QString fileName = QFileDialog::getOpenFileName(this, tr("Open LeanSheet"), "", tr("LeanSheet (*.lean);;All Files (*)"));
     if (fileName.isEmpty())
         return;
-    else
+    applyFile(parseFile(fileName), table);
+}
+
+// Reads a file into rows of fields. It touches no widget, so a file named
+// on the command line can be read on another thread while the window is
+// being built.
+LeanParsed LeanSheet::parseFile(const QString &fileName)
+{
+    LeanParsed parsed;
+    parsed.fileName = fileName;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        parsed.error = file.errorString();
+        return parsed;
+    }
+
+    QTextStream input(&file);
+    while (!input.atEnd())
+        parsed.rows.append(input.readLine().split(","));
+    return parsed;
+}
+
+// Loads the rows of a parsed file into a sheet.
+void LeanSheet::applyFile(const LeanParsed &parsed, LeanTable *sheet)
+{
+    if (!parsed.error.isEmpty())
+    {
+        QMessageBox::information(this, tr("Unable to open this lean"), parsed.error);
+        return;
+    }
+
+    delete curFile;
+    curFile = new QFile(parsed.fileName);
+
+    if (followedSheet == sheet)
+        stopFollowing();
+    sheet->clearContents();
+    writeRows(sheet, 0, parsed.rows);
+    views->setCurrentWidget(tabs);
+}
+
+// Loads a file being parsed on another thread once it is ready, leaving
+// the window free to show and respond meanwhile. The file goes into the
+// sheet that is current when this is called. If that sheet was edited or
+// closed in the meantime, so that no typing is lost to it, the file goes
+// into a new sheet instead and the status bar says so.
+void LeanSheet::openParsed(const QFuture<LeanParsed> &parsing)
+{
+    QPointer<LeanTable> sheet = table;
+    QSharedPointer<bool> isEdited(new bool(false));
+    QFutureWatcher<LeanParsed> *watcher = new QFutureWatcher<LeanParsed>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, sheet, isEdited]()
     {
-        curFile = new QFile(fileName);
-        if (!curFile->open(QIODevice::ReadOnly | QIODevice::Text))
+        LeanParsed parsed = watcher->result();
+        LeanTable *target = sheet;
+        if (target)
+            disconnect(target, nullptr, watcher, nullptr);
+        if (parsed.error.isEmpty() && (!target || *isEdited))
         {
-            QMessageBox::information(this, tr("Unable to open this lean"), curFile->errorString());
-            return;
+            target = createSheet(newSheetName());
+            tabs->setCurrentWidget(target);
+            statusBar()->showMessage(tr("%1 was opened in a new sheet, as its sheet changed while it was read")
+                                     .arg(QFileInfo(parsed.fileName).fileName()), 5000);
         }
+        applyFile(parsed, target);
+        watcher->deleteLater();
+        startupPhase("file opened");
+    });
+    connect(sheet, &LeanTable::cellsUpdated, watcher, [watcher, sheet, isEdited]()
+    {
+        disconnect(sheet, nullptr, watcher, nullptr);
+        *isEdited = true;
+    });
+    watcher->setFuture(parsing);
+}
+
+// Writes rows of fields into a sheet from row 'at', growing it once at the
+// bottom and right. The cells are written in one batch, so the workbook
+// and any pivot take in the block written once.
+void LeanSheet::writeRows(LeanTable *sheet, int at, const QList<QStringList> &rows)
+{
+    if (rows.isEmpty())
+        return;
+
+    int width = 0;
+    for (const QStringList &fields : rows)
+        width = qMin(qMax(width, fields.size()), ALPHA);
 
-        clear();
-        QTextStream input(curFile);
+    if (at + rows.size() > sheet->rowCount())
+        sheet->model()->insertRows(sheet->rowCount(), at + rows.size() - sheet->rowCount());
+    if (width > sheet->columnCount())
+    {
+        int first = sheet->columnCount();
+        sheet->model()->insertColumns(first, width - first);
+        for (int c = first; c < width; ++c)
+            sheet->setHorizontalHeaderItem(c, new QTableWidgetItem(QString(QChar('A' + c))));
+    }
 
-        for (int numLine = 0; !input.atEnd(); numLine++)
+    sheet->beginBatch();
+    for (int row = 0; row < rows.size(); row++)
+    {
+        const QStringList &fields = rows.at(row);
+        for (int col = 0; col < width && col < fields.size(); col++)
         {
-            if (numLine >= table->rowCount())
-                insertRow();
+            if (!fields.at(col).isEmpty())
+                sheet->setItem(at + row, col, new LeanItem(fields.at(col)));
+        }
+    }
+    sheet->endBatch();
+}
 
-            QString curLine = input.readLine();
-            QStringList data = curLine.split(",");
+// Loads a file into the current sheet and keeps appending whatever is
+// written to the end of it.
+void LeanSheet::followFile()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Follow LeanSheet"), "", tr("LeanSheet (*.lean);;All Files (*)"));
+    if (fileName.isEmpty())
+        return;
 
-            for (int size = 0; size < ALPHA && data.size() > table->columnCount(); size++)
-                insertCol();
+    stopFollowing();
+    clear();
+    follower = new LeanFollower(fileName, this);
+    followedSheet = table;
+    followedRows = 0;
+    connect(follower, &LeanFollower::linesAppended, this, &LeanSheet::appendFollowed);
+    connect(follower, &LeanFollower::truncated, this, &LeanSheet::restartFollowed);
+    views->setCurrentWidget(tabs);
 
-            for (int index = 0; index < ALPHA && index < data.size(); index++)
-                table->setItem(numLine, index, new LeanItem(data.value(index)));
+    if (!follower->start())
+    {
+        QMessageBox::information(this, tr("Unable to follow this lean"), follower->errorString());
+        stopFollowing();
+    }
+}
 
-            input.flush();
-        }
-        curFile->close();
+// Adds rows appended to the followed file below those read before.
+void LeanSheet::appendFollowed(const QList<QStringList> &rows)
+{
+    if (!followedSheet)
+        return;
+    writeRows(followedSheet, followedRows, rows);
+    followedRows += rows.size();
+    statusBar()->showMessage(tr("Following %1: %2 rows").arg(QFileInfo(follower->fileName()).fileName()).arg(followedRows));
+}
+
+// The followed file was rewritten, so its rows are read again from the top.
+void LeanSheet::restartFollowed()
+{
+    if (followedSheet)
+        followedSheet->clearContents();
+    followedRows = 0;
+}
+
+void LeanSheet::stopFollowing()
+{
+    delete follower;
+    follower = nullptr;
+    followedSheet = nullptr;
+    followedRows = 0;
+}
+
+// Opens a file for viewing only. It is mapped into memory rather than
+// copied into cells, so even very large files open at once.
+void LeanSheet::openReadOnly()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open LeanSheet Read-Only"), "", tr("LeanSheet (*.lean);;All Files (*)"));
+    if (fileName.isEmpty())
+        return;
+
+    LeanMappedModel *model = new LeanMappedModel(this);
+    if (!model->open(fileName))
+    {
+        QMessageBox::information(this, tr("Unable to open this lean"), model->errorString());
+        delete model;
+        return;
+    }
+
+    if (!mappedView)
+    {
+        mappedView = new QTableView();
+        views->addWidget(mappedView);
+        connect(mappedView->horizontalHeader(), &QHeaderView::sectionClicked,
+                this, &LeanSheet::summariseColumn);
     }
+
+    mappedView->setModel(model);
+    delete mappedModel;
+    mappedModel = model;
+    connect(mappedModel, &LeanMappedModel::indexed, this, &LeanSheet::showIndexed);
+    views->setCurrentWidget(mappedView);
+}
+
+// Reports how far the read-only file has been indexed.
+void LeanSheet::showIndexed(qint64 lines, bool done)
+{
+    if (done && mappedModel && mappedModel->isTruncated())
+        statusBar()->showMessage(tr("Only the first %1 lines can be shown (read-only)").arg(lines));
+    else if (done)
+        statusBar()->showMessage(tr("%1 lines (read-only)").arg(lines), 3000);
+    else
+        statusBar()->showMessage(tr("Indexing... %1 lines").arg(lines));
+}
+
+// Shows the summary of a column of the read-only file that was clicked.
+void LeanSheet::summariseColumn(int column)
+{
+    if (mappedModel)
+        statusBar()->showMessage(mappedModel->columnSummary(column));
 }
 
 // Saves data to a new or opened file.
@@ -249,10 +547,11 @@ void LeanSheet::saveFile()
     {
         for (int col = 0; col < table->columnCount(); col++)
         {
-            if (col == table->columnCount() - 1)
-                output << table->item(row,col)->text();
-            else
-                output << table->item(row,col)->text() << ",";
+            QTableWidgetItem *cur = table->item(row, col);
+            if (cur)
+                output << cur->text();
+            if (col != table->columnCount() - 1)
+                output << ",";
         }
         output << "\n";
     }
@@ -271,66 +570,357 @@ void LeanSheet::saveAs()
 // Inserts a new row into the sheet.
 void LeanSheet::insertRow()
 {
-    table->insertRow(table->rowCount());
-    for (int index = 0; index < table->columnCount(); index++)
-        table->setItem(table->rowCount() - 1, index, new LeanItem());
+    insertRows(table->rowCount(), 1);
 }
 
 // Inserts a new column into the sheet.
 void LeanSheet::insertCol()
 {
-    int colSize = table->columnCount();
-    QString character(QChar('A' + colSize));
+    insertColumns(table->columnCount(), 1);
+}
+
+// Inserts count empty rows before row 'at' with a single model notification.
+// New cells are not allocated; references below 'at', from this sheet or
+// any other, are shifted down.
+void LeanSheet::insertRows(int at, int count)
+{
+    if (count <= 0 || at < 0 || at > table->rowCount())
+        return;
 
-    if (colSize < ALPHA)
+    bool shifting = at < table->rowCount();
+    table->model()->insertRows(at, count);
+    if (shifting)
+        workbook->shiftReferences(table, at, count, 0, 0);
+}
+
+// Inserts count empty columns before column 'at', up to the last letter.
+void LeanSheet::insertColumns(int at, int count)
+{
+    count = qMin(count, ALPHA - table->columnCount());
+    if (count <= 0 || at < 0 || at > table->columnCount())
+        return;
+
+    bool shifting = at < table->columnCount();
+    table->model()->insertColumns(at, count);
+
+    // Every column from 'at' onwards now sits under a new letter.
+    for (int c = at; c < table->columnCount(); ++c)
+        table->setHorizontalHeaderItem(c, new QTableWidgetItem(QString(QChar('A' + c))));
+
+    if (shifting)
+        workbook->shiftReferences(table, 0, 0, at, count);
+}
+
+// Adds a sheet after the last one and shows it.
+void LeanSheet::insertSheet()
+{
+    LeanTable *sheet = createSheet(newSheetName());
+    tabs->setCurrentWidget(sheet);
+}
+
+// The first name of the form SheetN that no sheet has yet.
+QString LeanSheet::newSheetName() const
+{
+    int number = workbook->sheetCount() + 1;
+    while (workbook->sheet(tr("Sheet%1").arg(number)))
+        number++;
+    return tr("Sheet%1").arg(number);
+}
+
+// Asks for a new name for the sheet of a tab. Names are what formulas on
+// other sheets refer to it by, so they must be one word and unique.
+void LeanSheet::renameSheet(int index)
+{
+    LeanTable *sheet = qobject_cast<LeanTable *>(tabs->widget(index));
+    if (!sheet)
+        return;
+
+    bool ok = false;
+    QString name = QInputDialog::getText(this, tr("Rename Sheet"), tr("Sheet name:"),
+                                         QLineEdit::Normal, tabs->tabText(index), &ok).trimmed();
+    if (!ok || name.isEmpty())
+        return;
+    if (name.contains(' ') || name.contains('!') || name.contains(':') || !workbook->renameSheet(sheet, name))
     {
-    table->insertColumn(colSize);
-    table->setHorizontalHeaderItem(colSize, new QTableWidgetItem(character));
+        QMessageBox::information(this, tr("Unable to rename this sheet"),
+                                 tr("Sheet names must be unique and cannot contain spaces, '!' or ':'."));
+        return;
+    }
+    tabs->setTabText(index, name);
+}
+
+// Makes the sheet of a tab the one every menu operation works on.
+void LeanSheet::showSheet(int index)
+{
+    LeanTable *sheet = qobject_cast<LeanTable *>(tabs->widget(index));
+    if (!sheet || sheet == table)
+        return;
+    table = sheet;
 
-    for (int index = 0; index < table->rowCount(); index++)
-        table->setItem(index, colSize, new LeanItem());
+    // The sorted view belongs to the sheet it was made for.
+    if (sortProxy)
+    {
+        views->removeWidget(sortedView);
+        delete sortedView;
+        delete sortProxy;
+        sortedView = nullptr;
+        sortProxy = nullptr;
     }
+    views->setCurrentWidget(tabs);
+    followCursor();
 }
 
-// Sets selected cells to empty QStrings.
+// Copies the selected cells, then empties them in one batch.
 void LeanSheet::cut()
 {
-    foreach (QTableWidgetItem *cur, table->selectedItems())
-        cur->setText("");
+    copy();
+    table->beginBatch();
+    foreach (const QItemSelectionRange &range, sourceSelection())
+        clearRange(range.top(), range.left(), range.bottom(), range.right());
+    table->endBatch();
 }
 
-// Stores selected cells into QVector 'copied'.
+// Stores the cells of the selection that exist into 'copied', as they were
+// typed and relative to the top-left corner of the selection, so that
+// formulas are copied without being computed and empty cells take no room.
+// Rows past the last used one of the sheet are not walked at all.
 void LeanSheet::copy()
 {
-    if (!copied.empty())
-        copied.clear();
-    foreach (QTableWidgetItem *cur, table->selectedItems())
-        copied.append(cur->text());
+    copied.clear();
+    copiedSize = QSize();
+
+    QItemSelection selection = sourceSelection();
+    if (selection.isEmpty())
+        return;
+
+    QRect bounds;
+    foreach (const QItemSelectionRange &range, selection)
+        bounds |= QRect(range.left(), range.top(), range.width(), range.height());
+    copiedSize = bounds.size();
+
+    foreach (const QItemSelectionRange &range, selection)
+    {
+        int bottom = qMin(range.bottom(), table->usedRows() - 1);
+        for (int row = range.top(); row <= bottom; row++)
+        {
+            for (int col = range.left(); col <= range.right(); col++)
+            {
+                QTableWidgetItem *cur = table->item(row, col);
+                if (!cur)
+                    continue;
+                QString text = cur->data(Qt::EditRole).toString();
+                if (!text.isEmpty())
+                    copied.append(qMakePair(QPoint(col - bounds.left(), row - bounds.top()), text));
+            }
+        }
+    }
 }
 
-// Stores contents of copied into selected cells.
+// Stores contents of copied into the sheet, starting at the top-left
+// corner of the selection, in one batch.
 void LeanSheet::paste()
 {
-    int index = 0;
-    foreach (QTableWidgetItem *cur, table->selectedItems())
+    QModelIndex current = currentSourceIndex();
+    int top = current.row();
+    int left = current.column();
+    foreach (const QItemSelectionRange &range, sourceSelection())
     {
-        if (!copied.isEmpty() && index < copied.size())
+        top = qMin(top, range.top());
+        left = qMin(left, range.left());
+    }
+    if (top < 0 || left < 0 || copiedSize.isEmpty())
+        return;
+
+    table->beginBatch();
+    clearRange(top, left,
+               qMin(top + copiedSize.height(), table->rowCount()) - 1,
+               qMin(left + copiedSize.width(), table->columnCount()) - 1);
+
+    for (int index = 0; index < copied.size(); index++)
+    {
+        int row = top + copied.at(index).first.y();
+        int col = left + copied.at(index).first.x();
+        if (row >= table->rowCount() || col >= table->columnCount())
+            continue;
+        table->setItem(row, col, new LeanItem(copied.at(index).second));
+    }
+    table->endBatch();
+}
+
+// Empties a block of cells in one batch. Only the cells that exist are
+// taken out, and none past the last used row; nothing moves, so row
+// heights, column widths, indexes and the workbook's graph all stay.
+void LeanSheet::clearRange(int top, int left, int bottom, int right)
+{
+    bottom = qMin(bottom, table->usedRows() - 1);
+    if (top > bottom || left > right)
+        return;
+
+    table->beginBatch();
+    for (int row = top; row <= bottom; row++)
+    {
+        for (int col = left; col <= right; col++)
         {
-            cur->setText(copied.value(index));
-            index++;
+            if (table->item(row, col))
+                delete table->takeItem(row, col);
         }
-        else
-            cur->setText("");
     }
+    table->endBatch();
 }
 
-void LeanSheet::setupContents()
+// Sorts by the current column, either alone or after the existing keys.
+void LeanSheet::applySort(Qt::SortOrder order, bool addKey)
 {
-    for (int row = 0; row < table->rowCount(); row++)
+    QModelIndex current = currentSourceIndex();
+    if (!current.isValid())
+        return;
+
+    QVector<LeanSortKey> keys;
+    if (addKey)
+        keys = sorter()->sortKeys();
+    keys.append(LeanSortKey{ current.column(), order });
+    sorter()->setSortKeys(keys);
+    views->setCurrentWidget(sortedView);
+}
+
+void LeanSheet::sortAscending()
+{
+    applySort(Qt::AscendingOrder, false);
+}
+
+void LeanSheet::sortDescending()
+{
+    applySort(Qt::DescendingOrder, false);
+}
+
+void LeanSheet::thenAscending()
+{
+    applySort(Qt::AscendingOrder, true);
+}
+
+void LeanSheet::thenDescending()
+{
+    applySort(Qt::DescendingOrder, true);
+}
+
+// Hides every row that does not match the current cell in its column.
+void LeanSheet::filterByCell()
+{
+    QModelIndex current = currentSourceIndex();
+    if (!current.isValid())
+        return;
+
+    QTableWidgetItem *cur = table->item(current.row(), current.column());
+    sorter()->setFilter(current.column(), cur ? cur->text() : QString());
+    views->setCurrentWidget(sortedView);
+}
+
+// Drops every sort key and filter and goes back to the sheet itself.
+void LeanSheet::showAll()
+{
+    if (sortProxy)
+        sortProxy->clearAll();
+    views->setCurrentWidget(tabs);
+}
+
+// Summarises a column per group of key columns in a docked table, over
+// the selected rows or the whole sheet.
+void LeanSheet::pivot()
+{
+    bool ok = false;
+    QString keys = QInputDialog::getText(this, tr("Pivot"), tr("Group by columns (e.g. A B):"),
+                                         QLineEdit::Normal, QString(), &ok);
+    if (!ok || keys.trimmed().isEmpty())
+        return;
+    QString value = QInputDialog::getText(this, tr("Pivot"), tr("Summarise column:"),
+                                          QLineEdit::Normal, QString(), &ok);
+    if (!ok || value.trimmed().isEmpty())
+        return;
+
+    QVector<int> keyColumns;
+    // Empty parts are skipped by hand, as the flag for it moved in Qt 5.14.
+    foreach (const QString &key, keys.split(' '))
+    {
+        if (key.isEmpty())
+            continue;
+        int col = key.at(0).toUpper().toLatin1() - 'A';
+        if (col >= 0 && col < table->columnCount())
+            keyColumns.append(col);
+    }
+    int valueColumn = value.trimmed().at(0).toUpper().toLatin1() - 'A';
+    if (keyColumns.isEmpty() || valueColumn < 0 || valueColumn >= table->columnCount())
+    {
+        QMessageBox::information(this, tr("Pivot"), tr("Columns are named by their letter, such as A or B."));
+        return;
+    }
+
+    // A pivot over the whole sheet takes in rows appended to it, such as
+    // those of a followed file; one over selected rows keeps to them.
+    int firstRow = 0;
+    int lastRow = table->rowCount() - 1;
+    bool growsWithAppends = true;
+    QList<QTableWidgetSelectionRange> ranges = table->selectedRanges();
+    if (ranges.size() == 1 && ranges.first().rowCount() > 1)
     {
-        for (int col = 0; col < ALPHA && col < table->columnCount(); col++)
-            table->setItem(row, col, new LeanItem());
+        firstRow = ranges.first().topRow();
+        lastRow = ranges.first().bottomRow();
+        growsWithAppends = false;
     }
+
+    if (!pivotDock)
+    {
+        pivotDock = new QDockWidget(tr("Pivot"), this);
+        pivotOutput = new QTableWidget(pivotDock);
+        pivotDock->setWidget(pivotOutput);
+        addDockWidget(Qt::RightDockWidgetArea, pivotDock);
+    }
+
+    delete pivotEngine;
+    pivotEngine = new LeanPivot(table, pivotOutput, keyColumns, valueColumn, firstRow, lastRow,
+                                growsWithAppends, this);
+    pivotDock->show();
+}
+
+// Creates the sorted view the first time a sort or filter is asked for.
+LeanSortProxy *LeanSheet::sorter()
+{
+    if (!sortProxy)
+    {
+        sortProxy = new LeanSortProxy(table, this);
+        sortedView = new QTableView();
+        sortedView->setModel(sortProxy);
+        sortedView->setItemDelegate(new LeanDelegate(sortedView));
+        views->addWidget(sortedView);
+        connect(sortedView->selectionModel(), &QItemSelectionModel::currentChanged,
+                this, &LeanSheet::followCursor);
+    }
+    return sortProxy;
+}
+
+// The cell of the sheet under the cursor of whichever view is showing.
+QModelIndex LeanSheet::currentSourceIndex() const
+{
+    if (sortedView && views->currentWidget() == sortedView)
+        return sortProxy->mapToSource(sortedView->currentIndex());
+    return table->currentIndex();
+}
+
+QTableWidgetItem *LeanSheet::currentSourceItem() const
+{
+    QModelIndex current = currentSourceIndex();
+    if (!current.isValid())
+        return nullptr;
+    return table->item(current.row(), current.column());
+}
+
+// The selected cells of whichever view is showing, as cells of the sheet.
+// Rows next to each other in the sorted view need not be in the sheet, so
+// one range there may come back as several.
+QItemSelection LeanSheet::sourceSelection() const
+{
+    if (sortedView && views->currentWidget() == sortedView)
+        return sortProxy->mapSelectionToSource(sortedView->selectionModel()->selection());
+    return table->selectionModel()->selection();
 }
 
 /* Below are functions dedicated to the Help menu */
@@ -358,12 +948,29 @@ const char *functionText =
         "<li><b>max=</b> Cell Cell</li>"
         "<p>Finds the maximum value of consecutive cells."
         "</p>"
-        "<li><b>averagev=</b> Cell Cell</li>"
+        "<li><b>average=</b> Cell Cell</li>"
         "<p>Finds the average of consecutive cells."
         "</p>"
         "<li><b>stdev=</b> Cell Cell</li>"
         "<p>Finds the sample standard deviation of consecutive cells."
         "</p>"
+        "<li><b>var=</b> Cell Cell</li>"
+        "<p>Finds the sample variance of consecutive cells."
+        "</p>"
+        "<li><b>count=</b> Cell Cell</li>"
+        "<p>Counts the numeric cells among consecutive cells."
+        "</p>"
+        "<li><b>sumsq=</b> Cell Cell</li>"
+        "<p>Computes the sum of the squares of consecutive cells."
+        "</p>"
+        "<li><b>match=</b> Cell/Value Cell Cell [1]</li>"
+        "<p>Finds the position of a value within consecutive cells of a column. "
+        "With 1 at the end, finds the largest number no larger than the value."
+        "</p>"
+        "<li><b>vlookup=</b> Cell/Value Cell Cell Column [1]</li>"
+        "<p>Finds a value in the first column of consecutive cells and returns "
+        "the cell of the same row in the given column, counting from 1."
+        "</p>"
         "</HTML>";
 
 const char *operatorText =
@@ -386,6 +993,11 @@ const char *operatorText =
         "<li><b>^</b> -> Cell/Number ^ Cell/Number</li>"
         "<p>Raises any cell or number to the power of any cell or number."
         "</p>"
+        "<li><b>Ranges</b> -> Cell:Cell * Cell:Cell</li>"
+        "<p>Any operator also works on ranges such as A1:A100 * B1:B100, "
+        "or on a range and a single cell or number. The results fill the "
+        "formula's cell and the cells below it."
+        "</p>"
         "</HTML>";
 
 const char *aboutText =
@@ -402,14 +1014,25 @@ const char *aboutText =
         "</p>"
         "<p><b>To open a file:</b> under <b>File</b> select <b>Open</b>. "
         "This will allow you to open a *.lean or correctly parsed "
-        "*.txt and *.csv file."
+        "*.txt and *.csv file. <b>Open Read-Only</b> shows a file of any size "
+        "without loading it into cells; click a column header to summarise it. "
+        "<b>Follow File</b> opens a file that is still being written to and "
+        "adds the rows appended to it as they arrive."
         "</p>"
         "<p>The <b>Edit</b> menu allows you to cut, copy, and paste "
         "single or multiple cells anywhere in the sheet. "
         "<b>Shortcuts:</b> Copy - CTRL+C, Cut - CTRL+X, Paste - CTRL+V"
         "</p>"
         "<p>The <b>Insert</b> menu allows you to insert a new "
-        "row or column into the sheet."
+        "row, column or sheet. Double-click the tab of a sheet to rename it. "
+        "Formulas can read the cells of other sheets, as in <b>Sheet2!A1</b> "
+        "or <b>sum= Sheet2!A1 Sheet2!A10</b>, and update when those cells change."
+        "</p>"
+        "<p>The <b>Data</b> menu sorts the sheet by the current column, "
+        "adds further columns to sort by, or only shows the rows matching "
+        "the current cell. <b>Show All</b> returns to the unsorted sheet. "
+        "<b>Pivot</b> summarises a column for every group of values "
+        "in the columns you group by."
         "</p>"
         "<p>To access information regarding <b>Functions</b> or <b>Operators</b> "
         "click the <b>Help</b> menu or select the following "
@@ -434,6 +1057,19 @@ void LeanSheet::showAbout()
 
 /* Non-member functions */
 
+// Quiet unless asked for, as in QT_LOGGING_RULES="leansheets.startup.debug=true".
+Q_LOGGING_CATEGORY(leanStartup, "leansheets.startup", QtInfoMsg)
+
+// Logs how long after startup a phase was reached. The clock starts on
+// the first call, at the top of main().
+void startupPhase(const char *phase)
+{
+    static QElapsedTimer clock;
+    if (!clock.isValid())
+        clock.start();
+    qCDebug(leanStartup, "%s: %lld ms", phase, clock.elapsed());
+}
+
 // Case-insensitive decoder.
 void decode_pos(const QString &pos, int *row, int *col)
 {
@@ -450,6 +1086,15 @@ void decode_pos(const QString &pos, int *row, int *col)
     }
 }
 
+// Decodes a reference that may name another sheet, as in Data!A1, and
+// returns that sheet's name, or an empty string for the formula's own.
+QString decode_ref(const QString &ref, int *row, int *col)
+{
+    int bang = ref.lastIndexOf('!');
+    decode_pos(ref.mid(bang + 1), row, col);
+    return bang < 0 ? QString() : ref.left(bang);
+}
+
 /** Copyright (C) 2016 The Qt Company Ltd. **/
 QString encode_pos(int row, int col)
 {
@@ -3,13 +3,39 @@
 
 #include <QMainWindow>
 #include <QFile>
+#include <QFuture>
+#include <QLoggingCategory>
+#include <QStringList>
+
+// Columns are named by a single letter.
+#define ALPHA 26
 
 class QAction;
+class QMenu;
 class QLabel;
 class QLineEdit;
+class QModelIndex;
 class QToolBar;
 class QTableWidgetItem;
 class QTableWidget;
+class QTableView;
+class QStackedWidget;
+class QTabWidget;
+class LeanSortProxy;
+class LeanTable;
+class LeanPivot;
+class QDockWidget;
+class LeanMappedModel;
+class LeanWorkbook;
+class LeanFollower;
+
+// The rows read from a file, or why it could not be read.
+struct LeanParsed
+{
+    QString fileName;
+    QList<QStringList> rows;
+    QString error;
+};
 
 class LeanSheet : public QMainWindow
 {
@@ -19,61 +45,136 @@ public:
 
     LeanSheet(int rows, int cols, QWidget *parent = 0);
 
+    void insertRows(int at, int count);
+    void insertColumns(int at, int count);
+
+    static LeanParsed parseFile(const QString &fileName);
+    void applyFile(const LeanParsed &parsed, LeanTable *sheet);
+    void openParsed(const QFuture<LeanParsed> &parsing);
+
 public slots:
     void updateStatus(QTableWidgetItem *item);
     void updateLineEdit(QTableWidgetItem *item);
     void returnPressed();
+    void followCursor();
 
     void openFile();
+    void openReadOnly();
+    void followFile();
+    void appendFollowed(const QList<QStringList> &rows);
+    void restartFollowed();
+    void showIndexed(qint64 lines, bool done);
+    void summariseColumn(int column);
     void saveAs();
     void saveFile();
 
     void insertRow();
     void insertCol();
+    void insertSheet();
+    void renameSheet(int index);
+    void showSheet(int index);
 
     void cut();
     void copy();
     void paste();
 
+    void sortAscending();
+    void sortDescending();
+    void thenAscending();
+    void thenDescending();
+    void filterByCell();
+    void showAll();
+    void pivot();
+
     void showAbout();
     void showFunctions();
     void showOperators();
 
 protected:
-    void setupContents();
+    LeanTable *createSheet(const QString &name);
+    QString newSheetName() const;
+    void writeRows(LeanTable *sheet, int at, const QList<QStringList> &rows);
+    void stopFollowing();
     void clear();
     void setupMenuBar();
+    void setupDataMenu();
+    void setupHelpMenu();
     void createActions();
+    void clearRange(int top, int left, int bottom, int right);
+    void applySort(Qt::SortOrder order, bool addKey);
+    LeanSortProxy *sorter();
+    QModelIndex currentSourceIndex() const;
+    QTableWidgetItem *currentSourceItem() const;
+    QItemSelection sourceSelection() const;
 
 private:
     QToolBar *toolBar;
 
     QAction *openAction;
+    QAction *openReadOnlyAction;
+    QAction *followAction;
     QAction *saveAction;
     QAction *saveAsAction;
     QAction *exitAction;
 
     QAction *rowInsert;
     QAction *colInsert;
+    QAction *sheetInsert;
 
     QAction *cutAction;
     QAction *copyAction;
     QAction *pasteAction;
 
+    QMenu *dataMenu;
+    QMenu *helpMenu;
+
+    QAction *sortAscAction;
+    QAction *sortDescAction;
+    QAction *thenAscAction;
+    QAction *thenDescAction;
+    QAction *filterAction;
+    QAction *showAllAction;
+    QAction *pivotAction;
+
     QAction *functionList;
     QAction *operatorList;
     QAction *aboutLeanSheets;
 
     QFile *curFile;
-    QVector<QString> copied;
+    QVector<QPair<QPoint, QString> > copied;
+    QSize copiedSize;
 
     QLabel *cellLabel;
-    QTableWidget *table;
+    LeanTable *table;
     QLineEdit *formulaInput;
 
+    LeanWorkbook *workbook;
+    QTabWidget *tabs;
+    int sheetRows;
+    int sheetCols;
+
+    QStackedWidget *views;
+    QTableView *sortedView;
+    LeanSortProxy *sortProxy;
+
+    QTableView *mappedView;
+    LeanMappedModel *mappedModel;
+
+    LeanFollower *follower;
+    LeanTable *followedSheet;
+    int followedRows;
+
+    QDockWidget *pivotDock;
+    QTableWidget *pivotOutput;
+    LeanPivot *pivotEngine;
+
 };
 
+Q_DECLARE_LOGGING_CATEGORY(leanStartup)
+void startupPhase(const char *phase);
+
 void decode_pos(const QString &pos, int *row, int *col);
+QString decode_ref(const QString &ref, int *row, int *col);
 QString encode_pos(int row, int col);
 
 #endif // LEANSHEETS_H
@@ -0,0 +1,333 @@
+#include "leansort.h"
+#include "leanitem.h"
+
+#include <QtConcurrent>
+#include <QTableWidget>
+
+#include <algorithm>
+#include <cstring>
+
+// Bits of the key sorted on by each radix pass.
+#define RADIX_BITS 8
+// Rows below which a radix pass is not worth splitting across threads.
+#define RADIX_CHUNK 65536
+
+/****************************************************************************
+** The LeanSortProxy class presents the sheet sorted by one or more columns
+** and filtered on cell values, without moving a single LeanItem. It keeps
+** a permutation 'rows' from its own rows to the rows of the sheet, and
+** 'proxyRows' for the way back. Purely numeric columns are ordered with a
+** parallel radix sort; anything else falls back on a stable comparison.
+****************************************************************************/
+
+namespace {
+
+// What one cell holds, as far as sorting is concerned. Empty cells always
+// go last, whichever way a column is sorted.
+enum SortKind { NumberKind, TextKind, EmptyKind };
+
+struct SortColumn
+{
+    QVector<double> numbers;
+    QVector<QString> texts;
+    QVector<char> kinds;
+    bool numeric;
+};
+
+SortColumn extractColumn(const QTableWidget *table, int column)
+{
+    SortColumn values;
+    int count = table->rowCount();
+    values.numbers.resize(count);
+    values.texts.resize(count);
+    values.kinds.resize(count);
+    values.numeric = true;
+
+    for (int row = 0; row < count; row++)
+    {
+        values.kinds[row] = EmptyKind;
+        const QTableWidgetItem *cur = table->item(row, column);
+        if (!cur)
+            continue;
+
+        // Numbers were parsed on edit; formulas are sorted by their result.
+        QVariant value;
+        if (cur->type() != LeanItem::LeanType)
+            value = cur->text();
+        else if (static_cast<const LeanItem *>(cur)->cellType() == LeanItem::Number)
+            value = static_cast<const LeanItem *>(cur)->number();
+        else
+            value = static_cast<const LeanItem *>(cur)->display();
+
+        bool isNumber = value.type() == QVariant::Double;
+        double number = isNumber ? value.toDouble() : value.toString().toDouble(&isNumber);
+        if (isNumber)
+        {
+            values.kinds[row] = NumberKind;
+            values.numbers[row] = number;
+        }
+        else if (!value.toString().isEmpty())
+        {
+            values.kinds[row] = TextKind;
+            values.texts[row] = value.toString();
+            values.numeric = false;
+        }
+    }
+    return values;
+}
+
+// Maps a double onto an unsigned key with the same ordering.
+inline quint64 orderedBits(double value)
+{
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if (bits >> 63)
+        return ~bits;
+    return bits | (Q_UINT64_C(1) << 63);
+}
+
+}
+
+// Stable LSD radix sort of 'order' by keys[order[i]]. Every pass counts
+// digits per chunk of rows in parallel, then scatters each chunk into its
+// own slice of every bucket, which keeps the sort stable.
+void radixSort(QVector<int> &order, const QVector<quint64> &keys)
+{
+    const int count = order.size();
+    const int buckets = 1 << RADIX_BITS;
+    const int chunks = qBound(1, count / RADIX_CHUNK, QThread::idealThreadCount());
+
+    QVector<quint64> current(count);
+    for (int index = 0; index < count; index++)
+        current[index] = keys.at(order.at(index));
+
+    QVector<quint64> nextKeys(count);
+    QVector<int> nextOrder(count);
+    QVector<int> chunkIndices(chunks);
+    for (int chunk = 0; chunk < chunks; chunk++)
+        chunkIndices[chunk] = chunk;
+
+    // Per chunk, the count of each digit and then where it writes next.
+    QVector<int> offsets(chunks * buckets);
+
+    for (int shift = 0; shift < 64; shift += RADIX_BITS)
+    {
+        const quint64 *keysIn = current.constData();
+        const int *orderIn = order.constData();
+        quint64 *keysOut = nextKeys.data();
+        int *orderOut = nextOrder.data();
+        int *positions = offsets.data();
+        offsets.fill(0);
+
+        QtConcurrent::blockingMap(chunkIndices, [=](int chunk)
+        {
+            int first = qint64(count) * chunk / chunks;
+            int last = qint64(count) * (chunk + 1) / chunks;
+            int *histogram = positions + chunk * buckets;
+            for (int index = first; index < last; index++)
+                histogram[(keysIn[index] >> shift) & (buckets - 1)]++;
+        });
+
+        // A pass where every key shares the same digit moves nothing.
+        int start = 0;
+        bool uniform = false;
+        for (int bucket = 0; bucket < buckets && !uniform; bucket++)
+        {
+            int total = 0;
+            for (int chunk = 0; chunk < chunks; chunk++)
+            {
+                int size = positions[chunk * buckets + bucket];
+                positions[chunk * buckets + bucket] = start + total;
+                total += size;
+            }
+            uniform = total == count;
+            start += total;
+        }
+        if (uniform)
+            continue;
+
+        QtConcurrent::blockingMap(chunkIndices, [=](int chunk)
+        {
+            int first = qint64(count) * chunk / chunks;
+            int last = qint64(count) * (chunk + 1) / chunks;
+            int *position = positions + chunk * buckets;
+            for (int index = first; index < last; index++)
+            {
+                int target = position[(keysIn[index] >> shift) & (buckets - 1)]++;
+                keysOut[target] = keysIn[index];
+                orderOut[target] = orderIn[index];
+            }
+        });
+
+        current.swap(nextKeys);
+        order.swap(nextOrder);
+    }
+}
+
+LeanSortProxy::LeanSortProxy(QTableWidget *table, QObject *parent)
+        : QAbstractProxyModel(parent), table(table)
+{
+    QAbstractItemModel *source = table->model();
+    setSourceModel(source);
+
+    connect(source, &QAbstractItemModel::dataChanged, this, &LeanSortProxy::sourceDataChanged);
+    connect(source, &QAbstractItemModel::rowsInserted, this, &LeanSortProxy::refresh);
+    connect(source, &QAbstractItemModel::rowsRemoved, this, &LeanSortProxy::refresh);
+    connect(source, &QAbstractItemModel::columnsInserted, this, &LeanSortProxy::refresh);
+    connect(source, &QAbstractItemModel::columnsRemoved, this, &LeanSortProxy::refresh);
+    connect(source, &QAbstractItemModel::modelReset, this, &LeanSortProxy::refresh);
+
+    refresh();
+}
+
+// Replaces the sort order, most significant key first.
+void LeanSortProxy::setSortKeys(const QVector<LeanSortKey> &sortKeys)
+{
+    keys = sortKeys;
+    refresh();
+}
+
+// Only shows rows whose cell in 'column' reads exactly 'value'.
+void LeanSortProxy::setFilter(int column, const QString &value)
+{
+    filters.insert(column, value);
+    refresh();
+}
+
+void LeanSortProxy::clearAll()
+{
+    keys.clear();
+    filters.clear();
+    refresh();
+}
+
+// Rebuilds the permutation from the current contents of the sheet.
+void LeanSortProxy::refresh()
+{
+    beginResetModel();
+
+    rows.clear();
+    rows.reserve(table->rowCount());
+    for (int row = 0; row < table->rowCount(); row++)
+    {
+        bool shown = true;
+        for (QHash<int, QString>::const_iterator filter = filters.constBegin();
+             shown && filter != filters.constEnd(); ++filter)
+        {
+            const QTableWidgetItem *cur = table->item(row, filter.key());
+            shown = (cur ? cur->text() : QString()) == filter.value();
+        }
+        if (shown)
+            rows.append(row);
+    }
+
+    // Sorting by the least significant key first, with a stable sort each
+    // time, leaves rows ordered by every key at once.
+    for (int key = keys.size() - 1; key >= 0; key--)
+        sortBy(keys.at(key));
+
+    proxyRows.fill(-1, table->rowCount());
+    for (int row = 0; row < rows.size(); row++)
+        proxyRows[rows.at(row)] = row;
+
+    endResetModel();
+}
+
+void LeanSortProxy::sortBy(const LeanSortKey &key)
+{
+    if (key.column < 0 || key.column >= table->columnCount())
+        return;
+
+    SortColumn values = extractColumn(table, key.column);
+    bool ascending = key.order == Qt::AscendingOrder;
+
+    if (values.numeric)
+    {
+        QVector<quint64> radixKeys(values.kinds.size());
+        for (int row = 0; row < values.kinds.size(); row++)
+        {
+            if (values.kinds.at(row) == EmptyKind)
+                radixKeys[row] = ~Q_UINT64_C(0);
+            else if (ascending)
+                radixKeys[row] = orderedBits(values.numbers.at(row));
+            else
+                radixKeys[row] = ~orderedBits(values.numbers.at(row));
+        }
+        radixSort(rows, radixKeys);
+        return;
+    }
+
+    std::stable_sort(rows.begin(), rows.end(), [&](int left, int right)
+    {
+        char leftKind = values.kinds.at(left);
+        char rightKind = values.kinds.at(right);
+        if (leftKind != rightKind)
+        {
+            if (leftKind == EmptyKind || rightKind == EmptyKind)
+                return rightKind == EmptyKind;
+            return ascending ? leftKind < rightKind : leftKind > rightKind;
+        }
+        if (leftKind == NumberKind)
+        {
+            double a = values.numbers.at(left);
+            double b = values.numbers.at(right);
+            return ascending ? a < b : b < a;
+        }
+        if (leftKind == TextKind)
+        {
+            int compared = values.texts.at(left).compare(values.texts.at(right), Qt::CaseInsensitive);
+            return ascending ? compared < 0 : compared > 0;
+        }
+        return false;
+    });
+}
+
+void LeanSortProxy::sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight,
+                                      const QVector<int> &roles)
+{
+    // Edits show up in place; the order is only rebuilt when asked to.
+    for (int row = topLeft.row(); row <= bottomRight.row(); row++)
+    {
+        int proxyRow = proxyRows.value(row, -1);
+        if (proxyRow >= 0)
+            emit dataChanged(index(proxyRow, topLeft.column()),
+                             index(proxyRow, bottomRight.column()), roles);
+    }
+}
+
+QModelIndex LeanSortProxy::mapToSource(const QModelIndex &proxyIndex) const
+{
+    if (!proxyIndex.isValid() || proxyIndex.row() >= rows.size())
+        return QModelIndex();
+    return sourceModel()->index(rows.at(proxyIndex.row()), proxyIndex.column());
+}
+
+QModelIndex LeanSortProxy::mapFromSource(const QModelIndex &sourceIndex) const
+{
+    int proxyRow = sourceIndex.isValid() ? proxyRows.value(sourceIndex.row(), -1) : -1;
+    if (proxyRow < 0)
+        return QModelIndex();
+    return index(proxyRow, sourceIndex.column());
+}
+
+QModelIndex LeanSortProxy::index(int row, int column, const QModelIndex &parent) const
+{
+    if (parent.isValid() || row < 0 || row >= rows.size() || column < 0 || column >= columnCount())
+        return QModelIndex();
+    return createIndex(row, column);
+}
+
+QModelIndex LeanSortProxy::parent(const QModelIndex &) const
+{
+    return QModelIndex();
+}
+
+int LeanSortProxy::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.size();
+}
+
+int LeanSortProxy::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : table->columnCount();
+}
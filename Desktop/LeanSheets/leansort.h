@@ -0,0 +1,59 @@
+#ifndef LEANSORT_H
+#define LEANSORT_H
+
+#include <QAbstractProxyModel>
+#include <QHash>
+#include <QVector>
+
+class QTableWidget;
+
+// One column to order rows by, most significant key first.
+struct LeanSortKey
+{
+    int column;
+    Qt::SortOrder order;
+};
+
+class LeanSortProxy : public QAbstractProxyModel
+{
+    Q_OBJECT
+
+public:
+    LeanSortProxy(QTableWidget *table, QObject *parent = 0);
+
+    void setSortKeys(const QVector<LeanSortKey> &keys);
+    inline QVector<LeanSortKey> sortKeys() const { return keys; }
+    void setFilter(int column, const QString &value);
+    void clearAll();
+    inline bool isActive() const { return !keys.isEmpty() || !filters.isEmpty(); }
+
+    QModelIndex mapToSource(const QModelIndex &proxyIndex) const override;
+    QModelIndex mapFromSource(const QModelIndex &sourceIndex) const override;
+
+    QModelIndex index(int row, int column,
+                      const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &child) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+
+public slots:
+    void refresh();
+
+private slots:
+    void sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight,
+                           const QVector<int> &roles);
+
+private:
+    void sortBy(const LeanSortKey &key);
+
+    QTableWidget *table;
+    QVector<LeanSortKey> keys;
+    QHash<int, QString> filters;
+
+    QVector<int> rows;
+    QVector<int> proxyRows;
+};
+
+void radixSort(QVector<int> &order, const QVector<quint64> &keys);
+
+#endif // LEANSORT_H
@@ -0,0 +1,340 @@
+#include "leantable.h"
+#include "leanindex.h"
+#include "leanitem.h"
+#include "leanworkbook.h"
+
+LeanTable::LeanTable(int rows, int cols, QWidget *parent)
+        : QTableWidget(rows, cols, parent), isSpilling(false), batchDepth(0),
+          batched(LeanRange{ -1, -1, -1, -1 }), used(0)
+{
+    connect(model(), &QAbstractItemModel::dataChanged, this, &LeanTable::cellsChanged);
+    connect(model(), &QAbstractItemModel::rowsInserted, this, &LeanTable::rowsAdded);
+    connect(model(), &QAbstractItemModel::rowsRemoved, this, &LeanTable::rowsDropped);
+    connect(model(), &QAbstractItemModel::columnsInserted, this, &LeanTable::columnsAdded);
+    connect(model(), &QAbstractItemModel::columnsRemoved, this, &LeanTable::reshaped);
+    connect(model(), &QAbstractItemModel::modelReset, this, &LeanTable::contentsReset);
+}
+
+LeanTable::~LeanTable()
+{
+    disconnect(model(), nullptr, this, nullptr);
+    if (book)
+        book->removeSheet(this);
+    dropIndexes();
+}
+
+void LeanTable::setWorkbook(LeanWorkbook *workbook)
+{
+    book = workbook;
+}
+
+// The lookup index of a column, built the first time it is asked for.
+LeanIndex *LeanTable::columnIndex(int column) const
+{
+    LeanIndex *index = indexes.value(column);
+    if (!index)
+    {
+        index = new LeanIndex(this, column);
+        indexes.insert(column, index);
+    }
+    return index;
+}
+
+// Starts a batch of cell writes; batches may nest.
+void LeanTable::beginBatch()
+{
+    if (batchDepth++ == 0)
+        batched = LeanRange{ -1, -1, -1, -1 };
+}
+
+// Ends a batch, updating the sheet for the block of cells it changed.
+void LeanTable::endBatch()
+{
+    if (--batchDepth > 0 || batched.firstRow < 0)
+        return;
+    LeanRange block = batched;
+    batched = LeanRange{ -1, -1, -1, -1 };
+    updateCells(block.firstRow, block.firstCol, block.lastRow, block.lastCol);
+}
+
+// Tells views and proxies that results shown in a block changed, though
+// none of its cells were written.
+void LeanTable::reportComputed(int top, int left, int bottom, int right) const
+{
+    emit model()->dataChanged(model()->index(top, left), model()->index(bottom, right));
+}
+
+void LeanTable::cellsChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    if (!batchDepth)
+    {
+        updateCells(topLeft.row(), topLeft.column(), bottomRight.row(), bottomRight.column());
+        return;
+    }
+
+    if (batched.firstRow < 0)
+    {
+        batched = LeanRange{ topLeft.row(), topLeft.column(), bottomRight.row(), bottomRight.column() };
+        return;
+    }
+    batched.firstRow = qMin(batched.firstRow, topLeft.row());
+    batched.firstCol = qMin(batched.firstCol, topLeft.column());
+    batched.lastRow = qMax(batched.lastRow, bottomRight.row());
+    batched.lastCol = qMax(batched.lastCol, bottomRight.column());
+}
+
+void LeanTable::updateCells(int top, int left, int bottom, int right)
+{
+    // Only the rows of the block past the used ones have to be looked at.
+    for (int row = bottom; row >= qMax(top, used); row--)
+    {
+        for (int col = left; col <= right && row >= used; col++)
+        {
+            if (item(row, col))
+                used = row + 1;
+        }
+    }
+
+    for (int col = left; col <= right; col++)
+    {
+        LeanIndex *index = indexes.value(col);
+        if (!index)
+            continue;
+        for (int row = top; row <= bottom; row++)
+            index->update(row);
+    }
+
+    if (book)
+        book->cellsChanged(this, top, left, bottom, right);
+    emit cellsUpdated(top, left, bottom, right);
+
+    // Spilling reports the cells it wrote, which must not spill again.
+    if (isSpilling)
+        return;
+
+    QList<QPair<int, int> > anchors;
+    for (int col = left; col <= right; col++)
+    {
+        for (int row = top; row <= bottom; row++)
+        {
+            int anchor = arrayAnchor(row, col);
+            if (anchor >= 0 && !anchors.contains(qMakePair(anchor, col)))
+                anchors.append(qMakePair(anchor, col));
+        }
+    }
+    for (const QPair<int, int> &anchor : anchors)
+        spill(anchor.first, anchor.second);
+}
+
+// The row of the array formula whose results may have to move after the
+// cell at (row, column) changed, or -1. That is the cell itself, or the
+// formula spilling into or up to it from above.
+int LeanTable::arrayAnchor(int row, int column) const
+{
+    const QTableWidgetItem *cur = item(row, column);
+    if (cur && cur->type() == LeanItem::LeanType)
+    {
+        const LeanItem *leanItem = static_cast<const LeanItem *>(cur);
+        if (leanItem->cellType() == LeanItem::Spill)
+            return -1;
+        if (leanItem->isArray())
+            return row;
+    }
+
+    const QTableWidgetItem *above = item(row - 1, column);
+    if (!above || above->type() != LeanItem::LeanType)
+        return -1;
+
+    const LeanItem *leanAbove = static_cast<const LeanItem *>(above);
+    if (leanAbove->cellType() == LeanItem::Spill)
+        return row - 1 - leanAbove->spillOffset();
+    if (leanAbove->isArray())
+        return row - 1;
+
+    // A formula that was an array until its cell was edited.
+    const QTableWidgetItem *below = item(row + 1, column);
+    if (below && below->type() == LeanItem::LeanType
+            && static_cast<const LeanItem *>(below)->cellType() == LeanItem::Spill
+            && static_cast<const LeanItem *>(below)->spillOffset() == 1)
+        return row;
+    return -1;
+}
+
+// Fills the cells below an array formula with its results, or marks it as
+// blocked when any of them already holds something. Results that no longer
+// fit the formula are cleared. The cells are written with the model quiet
+// and reported in one dataChanged, so views, proxies, the sheet and its
+// workbook all take in a million results at once.
+void LeanTable::spill(int row, int column)
+{
+    QTableWidgetItem *cur = item(row, column);
+    LeanItem *anchor = (cur && cur->type() == LeanItem::LeanType) ? static_cast<LeanItem *>(cur) : nullptr;
+    int length = anchor ? anchor->arrayLength() : 0;
+
+    // The first offset already holding something, if any, blocks the spill.
+    int blockedAt = 0;
+    for (int offset = 1; offset < length && row + offset < rowCount() && !blockedAt; offset++)
+    {
+        const QTableWidgetItem *below = item(row + offset, column);
+        if (!below)
+            continue;
+        bool isTaken = false;
+        if (below->type() != LeanItem::LeanType)
+            isTaken = !below->text().isEmpty();
+        else
+        {
+            LeanItem::CellType type = static_cast<const LeanItem *>(below)->cellType();
+            isTaken = type != LeanItem::Empty && type != LeanItem::Spill;
+        }
+        if (isTaken)
+            blockedAt = offset;
+    }
+
+    isSpilling = true;
+    beginBatch();
+    if (!blockedAt && row + length > rowCount())
+        model()->insertRows(rowCount(), row + length - rowCount());
+
+    // The formula shows whether it is blocked, though its text is the same.
+    if (anchor && anchor->isSpillBlocked() != (blockedAt != 0))
+    {
+        anchor->setSpillBlocked(blockedAt != 0);
+        QModelIndex at = model()->index(row, column);
+        emit model()->dataChanged(at, at);
+    }
+
+    // A blocked formula keeps its spill cells up to the blocking one, empty,
+    // so that clearing that cell finds the formula again from above.
+    int written = blockedAt ? blockedAt : qMax(length, 1);
+    int first = -1;
+    int last = -1;
+    model()->blockSignals(true);
+    for (int offset = 1; offset < written; offset++)
+    {
+        QTableWidgetItem *below = item(row + offset, column);
+        if (below && below->type() == LeanItem::LeanType
+                && static_cast<LeanItem *>(below)->cellType() == LeanItem::Spill
+                && static_cast<LeanItem *>(below)->spillOffset() == offset)
+            continue;
+        setItem(row + offset, column, LeanItem::spillOf(offset));
+        if (first < 0)
+            first = row + offset;
+        last = row + offset;
+    }
+
+    // Whatever is left of an earlier, longer spill, or of one that rows
+    // were inserted into.
+    int cleared = clearSpill(row + written, column);
+    model()->blockSignals(false);
+
+    if (cleared > row + written)
+    {
+        if (first < 0)
+            first = row + written;
+        last = cleared - 1;
+    }
+    if (first >= 0)
+        emit model()->dataChanged(model()->index(first, column), model()->index(last, column));
+    endBatch();
+    isSpilling = false;
+}
+
+// Deletes the spill cells from 'row' down, up to the first cell that is not
+// one, and returns the row after the last of them. The caller quiets the
+// model and reports the rows cleared.
+int LeanTable::clearSpill(int row, int column)
+{
+    for (; row < rowCount(); row++)
+    {
+        QTableWidgetItem *below = item(row, column);
+        if (!below || below->type() != LeanItem::LeanType
+                || static_cast<LeanItem *>(below)->cellType() != LeanItem::Spill)
+            break;
+        delete takeItem(row, column);
+    }
+    return row;
+}
+
+// Rows inserted into or removed from a spill leave the cells after them
+// with offsets that no longer lead back to their formula. Every column is
+// checked at 'row', the first row after the change, and the formula found
+// from there spills again; if it was removed, its cells are cleared.
+// 'moved' is the number of rows inserted, or minus the number removed.
+void LeanTable::respill(int row, int moved)
+{
+    if (row >= rowCount())
+        return;
+
+    for (int col = 0; col < columnCount(); col++)
+    {
+        const QTableWidgetItem *cur = item(row, col);
+        if (!cur || cur->type() != LeanItem::LeanType
+                || static_cast<const LeanItem *>(cur)->cellType() != LeanItem::Spill)
+            continue;
+
+        int anchor = row - moved - static_cast<const LeanItem *>(cur)->spillOffset();
+        if (moved > 0 || anchor < row)
+        {
+            spill(anchor, col);
+            continue;
+        }
+
+        isSpilling = true;
+        model()->blockSignals(true);
+        int cleared = clearSpill(row, col);
+        model()->blockSignals(false);
+        emit model()->dataChanged(model()->index(row, col), model()->index(cleared - 1, col));
+        isSpilling = false;
+    }
+}
+
+// Rows added at the bottom move no cell, so the workbook's graph still holds.
+// Nor do they change any index, which only has to make room for them.
+void LeanTable::rowsAdded(const QModelIndex &, int first, int last)
+{
+    if (first < used)
+        used += last - first + 1;
+    if (last != rowCount() - 1)
+    {
+        reshaped();
+        respill(last + 1, last - first + 1);
+        return;
+    }
+    for (LeanIndex *index : indexes)
+        index->grow(rowCount());
+}
+
+void LeanTable::rowsDropped(const QModelIndex &, int first, int last)
+{
+    if (first < used)
+        used -= qMin(last + 1, used) - first;
+    reshaped();
+    respill(first, first - last - 1);
+}
+
+void LeanTable::columnsAdded(const QModelIndex &, int, int last)
+{
+    if (last != columnCount() - 1)
+        reshaped();
+}
+
+// QTableWidget only resets its model when it deletes every cell.
+void LeanTable::contentsReset()
+{
+    used = 0;
+    reshaped();
+}
+
+// Cells moved, so whatever was known by position is stale.
+void LeanTable::reshaped()
+{
+    dropIndexes();
+    if (book)
+        book->sheetReshaped(this);
+}
+
+void LeanTable::dropIndexes()
+{
+    qDeleteAll(indexes);
+    indexes.clear();
+}
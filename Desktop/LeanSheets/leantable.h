@@ -0,0 +1,72 @@
+#ifndef LEANTABLE_H
+#define LEANTABLE_H
+
+#include "leanformula.h"
+
+#include <QHash>
+#include <QPointer>
+#include <QTableWidget>
+
+class LeanIndex;
+class LeanWorkbook;
+
+/****************************************************************************
+** The LeanTable class is the QTableWidget of a sheet, along with the state
+** its formulas share, such as the lookup indexes of its columns. It keeps
+** that state in step with its model: edited cells are re-indexed one at a
+** time, while inserted or removed rows and columns drop every index.
+** Changes are passed on to the workbook of the sheet, which tracks what
+** formulas read, and edits near an array formula spill its results again
+** into the cells below it. Between beginBatch() and endBatch(), all of
+** this is done once for the block of cells changed meanwhile, while the
+** model still reports every cell to views and proxies. cellsUpdated() is
+** emitted once per such block, for those that only need the whole of it.
+** No cell lies at or below usedRows(), so walks over whole columns can
+** stop there; it may overshoot after cells are cleared, but never falls short.
+****************************************************************************/
+
+class LeanTable : public QTableWidget
+{
+    Q_OBJECT
+
+public:
+    LeanTable(int rows, int cols, QWidget *parent = 0);
+    ~LeanTable();
+
+    LeanIndex *columnIndex(int column) const;
+    inline LeanWorkbook *workbook() const { return book; }
+    void setWorkbook(LeanWorkbook *workbook);
+
+    void beginBatch();
+    void endBatch();
+    inline int usedRows() const { return qMin(used, rowCount()); }
+    void reportComputed(int top, int left, int bottom, int right) const;
+
+signals:
+    void cellsUpdated(int top, int left, int bottom, int right);
+
+private slots:
+    void cellsChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void rowsAdded(const QModelIndex &parent, int first, int last);
+    void rowsDropped(const QModelIndex &parent, int first, int last);
+    void contentsReset();
+    void columnsAdded(const QModelIndex &parent, int first, int last);
+    void reshaped();
+    void dropIndexes();
+
+private:
+    void updateCells(int top, int left, int bottom, int right);
+    int arrayAnchor(int row, int column) const;
+    void spill(int row, int column);
+    void respill(int row, int moved);
+    int clearSpill(int row, int column);
+
+    mutable QHash<int, LeanIndex *> indexes;
+    QPointer<LeanWorkbook> book;
+    bool isSpilling;
+    int batchDepth;
+    LeanRange batched;
+    int used;
+};
+
+#endif // LEANTABLE_H
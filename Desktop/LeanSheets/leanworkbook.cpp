@@ -0,0 +1,386 @@
+#include "leanworkbook.h"
+#include "leanitem.h"
+#include "leantable.h"
+
+#include <QTimer>
+
+#include <algorithm>
+
+LeanWorkbook::LeanWorkbook(QObject *parent)
+        : QObject(parent), isScheduled(false), isStale(false), recalculating(false)
+{
+}
+
+// Adds a sheet under a name formulas can refer to it by.
+void LeanWorkbook::addSheet(LeanTable *sheet, const QString &name)
+{
+    sheets.append(sheet);
+    names.append(name);
+    sheet->setWorkbook(this);
+
+    // References to the name may have been written before the sheet existed.
+    sheetReshaped(sheet);
+}
+
+void LeanWorkbook::removeSheet(LeanTable *sheet)
+{
+    int index = sheets.indexOf(sheet);
+    if (index < 0)
+        return;
+    sheets.remove(index);
+    names.removeAt(index);
+    sheetReshaped(sheet);
+}
+
+// Renames a sheet, unless another sheet already has the name, along with
+// every reference naming it in the formulas of every sheet.
+bool LeanWorkbook::renameSheet(LeanTable *sheet, const QString &name)
+{
+    int index = sheets.indexOf(sheet);
+    LeanTable *other = this->sheet(name);
+    if (index < 0 || (other && other != sheet))
+        return false;
+    QString oldName = names.at(index);
+    names[index] = name;
+
+    for (LeanTable *formulas : sheets)
+    {
+        formulas->beginBatch();
+        for (int row = 0; row < formulas->rowCount(); row++)
+        {
+            for (int col = 0; col < formulas->columnCount(); col++)
+            {
+                QTableWidgetItem *cur = formulas->item(row, col);
+                if (cur && cur->type() == LeanItem::LeanType)
+                    static_cast<LeanItem *>(cur)->renameReferences(oldName, name);
+            }
+        }
+        formulas->endBatch();
+    }
+
+    sheetReshaped(sheet);
+    return true;
+}
+
+// The sheet with a name, ignoring case, or nullptr.
+LeanTable *LeanWorkbook::sheet(const QString &name) const
+{
+    for (int index = 0; index < names.count(); index++)
+    {
+        if (names.at(index).compare(name, Qt::CaseInsensitive) == 0)
+            return sheets.at(index);
+    }
+    return nullptr;
+}
+
+QString LeanWorkbook::sheetName(const LeanTable *sheet) const
+{
+    int index = sheets.indexOf(const_cast<LeanTable *>(sheet));
+    return index < 0 ? QString() : names.at(index);
+}
+
+int LeanWorkbook::sheetCount() const
+{
+    return sheets.count();
+}
+
+// The sheet a reference names, seen from the sheet holding the formula:
+// that sheet itself when no name is given, and nullptr for an unknown one.
+const QTableWidget *LeanWorkbook::sheetOf(const QString &name, const QTableWidget *widget)
+{
+    if (name.isEmpty())
+        return widget;
+    const LeanTable *table = qobject_cast<const LeanTable *>(widget);
+    if (!table || !table->workbook())
+        return nullptr;
+    return table->workbook()->sheet(name);
+}
+
+// Called for every block of cells whose contents changed: formulas typed
+// into them are tracked anew, and whatever reads them is marked dirty.
+void LeanWorkbook::cellsChanged(LeanTable *sheet, int top, int left, int bottom, int right)
+{
+    // Reporting dirty cells to their views is not itself an edit.
+    if (recalculating)
+        return;
+
+    if (!isStale)
+    {
+        for (int row = top; row <= bottom; row++)
+        {
+            for (int col = left; col <= right; col++)
+            {
+                LeanCell cell = { sheet, row, col };
+                const QTableWidgetItem *cur = sheet->item(row, col);
+                bool isFormula = cur && cur->type() == LeanItem::LeanType
+                        && static_cast<const LeanItem *>(cur)->cellType() == LeanItem::Formula;
+                if (isFormula || precedents.contains(cell) || rangeReaders.contains(cell))
+                    track(cell);
+            }
+        }
+    }
+
+    markDependents(sheet, { top, left, bottom, right });
+    schedule();
+}
+
+// Rows or columns moved under the graph, or the sheets themselves changed.
+void LeanWorkbook::sheetReshaped(LeanTable *)
+{
+    isStale = true;
+    schedule();
+}
+
+// Moves references to cells at or past (atRow, atCol) of a sheet by rows
+// and cols, in the formulas of every sheet: those on the sheet itself, and
+// those elsewhere naming it.
+void LeanWorkbook::shiftReferences(const LeanTable *sheet, int atRow, int rows, int atCol, int cols)
+{
+    QString name = sheetName(sheet);
+    if (name.isEmpty())
+        return;
+
+    for (int index = 0; index < sheets.count(); index++)
+    {
+        LeanTable *formulas = sheets.at(index);
+        formulas->beginBatch();
+        for (int row = 0; row < formulas->rowCount(); row++)
+        {
+            for (int col = 0; col < formulas->columnCount(); col++)
+            {
+                QTableWidgetItem *cur = formulas->item(row, col);
+                if (cur && cur->type() == LeanItem::LeanType)
+                    static_cast<LeanItem *>(cur)->shiftReferences(name, names.at(index), atRow, rows, atCol, cols);
+            }
+        }
+        formulas->endBatch();
+    }
+}
+
+// Records which cells the formula at cell reads, replacing what it read before.
+void LeanWorkbook::track(const LeanCell &cell)
+{
+    untrack(cell);
+
+    const QTableWidgetItem *cur = cell.sheet->item(cell.row, cell.col);
+    if (!cur || cur->type() != LeanItem::LeanType)
+        return;
+    const LeanFormula *formula = static_cast<const LeanItem *>(cur)->compiled();
+    if (!formula)
+        return;
+
+    for (const LeanReference &reference : formula->references())
+    {
+        const LeanTable *source = qobject_cast<const LeanTable *>(sheetOf(reference.sheet, cell.sheet));
+        if (!source)
+            continue;
+
+        LeanRange range = reference.range;
+        if (range.firstRow == range.lastRow && range.firstCol == range.lastCol)
+        {
+            LeanCell precedent = { source, range.firstRow, range.firstCol };
+            cellReaders[precedent].append(cell);
+            precedents[cell].append(precedent);
+        }
+        else
+        {
+            // Columns past the sheet hold nothing to change.
+            range.lastCol = qMin(range.lastCol, source->columnCount() - 1);
+            rangeReaders[cell].append(RangeReader{ source, range });
+            for (int col = range.firstCol; col <= range.lastCol; col++)
+                columnReaders[LeanColumn(source, col)].append(ColumnReader{ cell, range.firstRow, range.lastRow });
+        }
+    }
+}
+
+void LeanWorkbook::untrack(const LeanCell &cell)
+{
+    for (const LeanCell &precedent : precedents.take(cell))
+    {
+        auto readers = cellReaders.find(precedent);
+        if (readers == cellReaders.end())
+            continue;
+        readers->removeAll(cell);
+        if (readers->isEmpty())
+            cellReaders.erase(readers);
+    }
+
+    for (const RangeReader &reader : rangeReaders.take(cell))
+    {
+        for (int col = reader.range.firstCol; col <= reader.range.lastCol; col++)
+        {
+            auto readers = columnReaders.find(LeanColumn(reader.sheet, col));
+            if (readers == columnReaders.end())
+                continue;
+            readers->erase(std::remove_if(readers->begin(), readers->end(),
+                                          [&cell](const ColumnReader &read) { return read.formula == cell; }),
+                           readers->end());
+            if (readers->isEmpty())
+                columnReaders.erase(readers);
+        }
+    }
+}
+
+// Marks every formula reading the changed block dirty, then every formula
+// reading those, and so on. A formula is visited once however many paths
+// lead to it, which also stops at circular references.
+void LeanWorkbook::markDependents(const LeanTable *sheet, const LeanRange &changed)
+{
+    QVector<QPair<const LeanTable *, LeanRange> > pending;
+    pending.append(qMakePair(sheet, changed));
+
+    auto visit = [this, &pending](const LeanCell &formula)
+    {
+        if (dirty.contains(formula))
+            return;
+        dirty.insert(formula);
+
+        // A dirty array formula changes every cell it spills into as well.
+        int length = 1;
+        const QTableWidgetItem *cur = formula.sheet->item(formula.row, formula.col);
+        if (cur && cur->type() == LeanItem::LeanType)
+        {
+            const LeanItem *leanItem = static_cast<const LeanItem *>(cur);
+            leanItem->markDirty();
+            length = qMax(1, leanItem->arrayLength());
+        }
+        pending.append(qMakePair(formula.sheet, LeanRange{ formula.row, formula.col,
+                                                          formula.row + length - 1, formula.col }));
+    };
+
+    while (!pending.isEmpty())
+    {
+        const LeanTable *source = pending.last().first;
+        LeanRange range = pending.last().second;
+        pending.removeLast();
+
+        // Looks up the cells of small blocks, and checks the readers of large ones.
+        qint64 cells = qint64(range.lastRow - range.firstRow + 1) * (range.lastCol - range.firstCol + 1);
+        if (cells <= cellReaders.size())
+        {
+            for (int row = range.firstRow; row <= range.lastRow; row++)
+            {
+                for (int col = range.firstCol; col <= range.lastCol; col++)
+                {
+                    for (const LeanCell &reader : cellReaders.value(LeanCell{ source, row, col }))
+                        visit(reader);
+                }
+            }
+        }
+        else
+        {
+            QVector<LeanCell> readers;
+            for (auto it = cellReaders.constBegin(); it != cellReaders.constEnd(); ++it)
+            {
+                const LeanCell &precedent = it.key();
+                if (precedent.sheet == source
+                        && precedent.row >= range.firstRow && precedent.row <= range.lastRow
+                        && precedent.col >= range.firstCol && precedent.col <= range.lastCol)
+                    readers += it.value();
+            }
+            for (const LeanCell &reader : readers)
+                visit(reader);
+        }
+
+        // Ranges are only checked in the columns of the block.
+        QVector<LeanCell> readers;
+        for (int col = range.firstCol; col <= range.lastCol; col++)
+        {
+            auto column = columnReaders.constFind(LeanColumn(source, col));
+            if (column == columnReaders.constEnd())
+                continue;
+            for (const ColumnReader &reader : column.value())
+            {
+                if (reader.firstRow <= range.lastRow && range.firstRow <= reader.lastRow)
+                    readers.append(reader.formula);
+            }
+        }
+        for (const LeanCell &reader : readers)
+            visit(reader);
+    }
+}
+
+// Tracks every formula of every sheet again, all of them dirty.
+void LeanWorkbook::rebuild()
+{
+    cellReaders.clear();
+    rangeReaders.clear();
+    columnReaders.clear();
+    precedents.clear();
+    dirty.clear();
+    isStale = false;
+
+    for (LeanTable *sheet : sheets)
+    {
+        for (int row = 0; row < sheet->rowCount(); row++)
+        {
+            for (int col = 0; col < sheet->columnCount(); col++)
+            {
+                const QTableWidgetItem *cur = sheet->item(row, col);
+                if (!cur || cur->type() != LeanItem::LeanType)
+                    continue;
+                const LeanItem *leanItem = static_cast<const LeanItem *>(cur);
+                if (!leanItem->isComputed())
+                    continue;
+                leanItem->markDirty();
+                if (leanItem->cellType() == LeanItem::Formula)
+                    track(LeanCell{ sheet, row, col });
+            }
+        }
+        sheet->viewport()->update();
+    }
+}
+
+void LeanWorkbook::schedule()
+{
+    if (isScheduled)
+        return;
+    isScheduled = true;
+    QTimer::singleShot(0, this, &LeanWorkbook::recalculate);
+}
+
+// Tells the views of every sheet with dirty cells that they changed, once
+// per batch of edits, with one block per sheet spanning its dirty cells,
+// then reports the same blocks through recalculated().
+void LeanWorkbook::recalculate()
+{
+    isScheduled = false;
+    bool isRebuilt = isStale;
+    if (isStale)
+        rebuild();
+
+    QSet<LeanCell> cells;
+    cells.swap(dirty);
+
+    QHash<const LeanTable *, LeanRange> blocks;
+    for (const LeanCell &cell : cells)
+    {
+        if (!sheets.contains(const_cast<LeanTable *>(cell.sheet)))
+            continue;
+
+        auto block = blocks.find(cell.sheet);
+        if (block == blocks.end())
+        {
+            blocks.insert(cell.sheet, LeanRange{ cell.row, cell.col, cell.row, cell.col });
+            continue;
+        }
+        block->firstRow = qMin(block->firstRow, cell.row);
+        block->firstCol = qMin(block->firstCol, cell.col);
+        block->lastRow = qMax(block->lastRow, cell.row);
+        block->lastCol = qMax(block->lastCol, cell.col);
+    }
+
+    recalculating = true;
+    for (auto block = blocks.constBegin(); block != blocks.constEnd(); ++block)
+        block.key()->reportComputed(block->firstRow, block->firstCol, block->lastRow, block->lastCol);
+    recalculating = false;
+
+    // A rebuild marks every formula dirty without listing them.
+    if (isRebuilt)
+    {
+        for (const LeanTable *sheet : sheets)
+            blocks.insert(sheet, LeanRange{ 0, 0, sheet->rowCount() - 1, sheet->columnCount() - 1 });
+    }
+    for (auto block = blocks.constBegin(); block != blocks.constEnd(); ++block)
+        emit recalculated(block.key(), block->firstRow, block->firstCol, block->lastRow, block->lastCol);
+}
@@ -0,0 +1,114 @@
+#ifndef LEANWORKBOOK_H
+#define LEANWORKBOOK_H
+
+#include "leanformula.h"
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+class LeanTable;
+
+// One cell of one sheet of a workbook.
+struct LeanCell
+{
+    const LeanTable *sheet;
+    int row;
+    int col;
+};
+
+inline bool operator==(const LeanCell &a, const LeanCell &b)
+{
+    return a.sheet == b.sheet && a.row == b.row && a.col == b.col;
+}
+
+inline uint qHash(const LeanCell &cell, uint seed = 0)
+{
+    return qHash(quintptr(cell.sheet), seed) ^ qHash((quint64(cell.row) << 8) | quint64(cell.col), seed);
+}
+
+/****************************************************************************
+** A LeanWorkbook holds the sheets of one window by name, so that formulas
+** can read cells of other sheets as Sheet2!A1, and keeps one dependency
+** graph over all of them. A formula reading a single cell is found through
+** a hash from that cell; one reading a range, through a hash from each
+** column of the range, so that a change only checks the ranges over its
+** own columns. The ranges are also kept under the formula's cell, to find
+** them again when it is edited.
+** An edit marks every formula depending on it, however indirectly, dirty
+** at once, and a recalculation queued on the event loop then reports all
+** of them to their views together, however many edits came in meanwhile.
+** Inserting or removing rows or columns in the middle of a sheet moves
+** cells under the graph, which is then rebuilt on the next recalculation.
+** Anything else showing results, such as a pivot, hears of each
+** recalculation once per sheet through recalculated().
+****************************************************************************/
+
+class LeanWorkbook : public QObject
+{
+    Q_OBJECT
+
+public:
+    LeanWorkbook(QObject *parent = 0);
+
+    void addSheet(LeanTable *sheet, const QString &name);
+    void removeSheet(LeanTable *sheet);
+    bool renameSheet(LeanTable *sheet, const QString &name);
+    LeanTable *sheet(const QString &name) const;
+    QString sheetName(const LeanTable *sheet) const;
+    int sheetCount() const;
+
+    void cellsChanged(LeanTable *sheet, int top, int left, int bottom, int right);
+    void sheetReshaped(LeanTable *sheet);
+    void shiftReferences(const LeanTable *sheet, int atRow, int rows, int atCol, int cols);
+
+    static const QTableWidget *sheetOf(const QString &name, const QTableWidget *widget);
+
+    inline bool isRecalculating() const { return recalculating; }
+
+signals:
+    void recalculated(const QTableWidget *sheet, int top, int left, int bottom, int right);
+
+private slots:
+    void recalculate();
+
+private:
+    // A block of cells a formula reads, kept under the formula's cell.
+    struct RangeReader
+    {
+        const LeanTable *sheet;
+        LeanRange range;
+    };
+
+    // A formula reading rows of a column, kept under that column.
+    struct ColumnReader
+    {
+        LeanCell formula;
+        int firstRow;
+        int lastRow;
+    };
+    typedef QPair<const LeanTable *, int> LeanColumn;
+
+    void track(const LeanCell &cell);
+    void untrack(const LeanCell &cell);
+    void markDependents(const LeanTable *sheet, const LeanRange &changed);
+    void rebuild();
+    void schedule();
+
+    QVector<LeanTable *> sheets;
+    QStringList names;
+
+    QHash<LeanCell, QVector<LeanCell> > cellReaders;
+    QHash<LeanCell, QVector<RangeReader> > rangeReaders;
+    QHash<LeanColumn, QVector<ColumnReader> > columnReaders;
+    QHash<LeanCell, QVector<LeanCell> > precedents;
+    QSet<LeanCell> dirty;
+
+    bool isScheduled;
+    bool isStale;
+    bool recalculating;
+};
+
+#endif // LEANWORKBOOK_H
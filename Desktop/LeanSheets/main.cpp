@@ -56,16 +56,33 @@
 #include <QApplication>
 #include <QLayout>
 #include <QScreen>
+#include <QTimer>
+#include <QtConcurrent>
 
 #define MAX_HEIGHT 25
 #define MAX_WIDTH  100
 
 int main(int argc, char** argv) {
+    startupPhase("main");
     Q_INIT_RESOURCE(leanfiles);
     QApplication app(argc, argv);
+    startupPhase("application created");
+
+    // A file named on the command line is read while the window is built.
+    QFuture<LeanParsed> parsing;
+    QStringList arguments = app.arguments();
+    if (arguments.size() > 1)
+        parsing = QtConcurrent::run(&LeanSheet::parseFile, arguments.at(1));
+
     QScreen* myScreen = QGuiApplication::primaryScreen();
     QRect screenGeo = myScreen->geometry();
     LeanSheet newSheet(screenGeo.height() / MAX_HEIGHT, screenGeo.width() / MAX_WIDTH);
+    startupPhase("window created");
     newSheet.show();
+    startupPhase("window shown");
+
+    if (arguments.size() > 1)
+        newSheet.openParsed(parsing);
+    QTimer::singleShot(0, [] { startupPhase("event loop running"); });
     return app.exec();
 }